@@ -0,0 +1,23 @@
+#pragma once
+#include <atomic>
+#include <memory>
+
+// Cooperative cancellation flag. Copies share the same state, so a caller can
+// keep one copy and hand another to an asynchronous query.
+class CancellationToken {
+
+public:
+
+    CancellationToken() : cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void Cancel() const {
+        cancelled_->store(true, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const {
+        return cancelled_->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled_;
+};
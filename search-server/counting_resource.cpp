@@ -0,0 +1,34 @@
+#include "counting_resource.h"
+#include <stdexcept>
+
+CountingResource::CountingResource(std::pmr::memory_resource* upstream) : upstream_(upstream) {
+    if (upstream_ == nullptr) {
+        throw std::invalid_argument("Upstream memory resource is null");
+    }
+}
+
+size_t CountingResource::GetAllocatedBytes() const {
+    return allocated_.load(std::memory_order_relaxed);
+}
+
+size_t CountingResource::GetPeakBytes() const {
+    return peak_.load(std::memory_order_relaxed);
+}
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    void* p = upstream_->allocate(bytes, alignment);
+    const size_t now = allocated_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+    }
+    return p;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    upstream_->deallocate(p, bytes, alignment);
+    allocated_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+
+// Forwards every request to an upstream resource and keeps track of how many
+// bytes are currently allocated through it.
+class CountingResource : public std::pmr::memory_resource {
+
+public:
+
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+
+    size_t GetAllocatedBytes() const;
+
+    size_t GetPeakBytes() const;
+
+private:
+    std::pmr::memory_resource* upstream_;
+    std::atomic<size_t> allocated_{0};
+    std::atomic<size_t> peak_{0};
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
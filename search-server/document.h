@@ -1,6 +1,8 @@
 #pragma once
 #include <ostream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 enum class DocumentStatus
 {
@@ -25,4 +27,13 @@ struct Document
 };
 
 
+struct DocumentData
+{
+    int id = 0;
+    std::string text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+
 std::ostream& operator<<(std::ostream& out, const Document& doc);
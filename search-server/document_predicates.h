@@ -0,0 +1,12 @@
+#pragma once
+#include "document.h"
+
+// Predicate the status overloads of FindTopDocuments pass to the generic path.
+struct StatusIs
+{
+    DocumentStatus status = DocumentStatus::ACTUAL;
+
+    constexpr bool operator()(int, DocumentStatus document_status, int) const {
+        return document_status == status;
+    }
+};
@@ -0,0 +1,46 @@
+#include "forward_index.h"
+#include <algorithm>
+#include <stdexcept>
+
+ForwardIndex::ForwardIndex(std::pmr::memory_resource* resource) : entries_(resource), runs_(resource) {}
+
+void ForwardIndex::Add(int document_id, const std::vector<TermFrequency>& entries) {
+    if (runs_.count(document_id) != 0) {
+        throw std::invalid_argument("Document is already in the forward index");
+    }
+    runs_.emplace(document_id, Run{entries_.size(), entries.size()});
+    entries_.insert(entries_.end(), entries.begin(), entries.end());
+}
+
+void ForwardIndex::Remove(int document_id) {
+    const auto it = runs_.find(document_id);
+    if (it == runs_.end()) {
+        return;
+    }
+    free_entries_ += it->second.size;
+    runs_.erase(it);
+    if (free_entries_ > entries_.size() - free_entries_) {
+        Compact();
+    }
+}
+
+TermFrequencyRange ForwardIndex::Get(int document_id) const {
+    const Run& run = runs_.at(document_id);
+    const TermFrequency* first = entries_.data() + run.offset;
+    return {first, first + run.size};
+}
+
+void ForwardIndex::Compact() {
+    if (free_entries_ == 0 && entries_.capacity() == entries_.size()) {
+        return;
+    }
+    std::pmr::vector<TermFrequency> compacted(entries_.get_allocator());
+    compacted.reserve(entries_.size() - free_entries_);
+    for (auto& [id, run] : runs_) {
+        const auto first = entries_.begin() + run.offset;
+        run.offset = compacted.size();
+        compacted.insert(compacted.end(), first, first + run.size);
+    }
+    entries_ = std::move(compacted);
+    free_entries_ = 0;
+}
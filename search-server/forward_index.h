@@ -0,0 +1,97 @@
+#pragma once
+#include "term_dictionary.h"
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <memory_resource>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct TermFrequency
+{
+    TermId term = 0;
+    double tf = 0.0;
+};
+
+// Contiguous, term-sorted entries of one document.
+struct TermFrequencyRange
+{
+    const TermFrequency* first = nullptr;
+    const TermFrequency* last = nullptr;
+
+    const TermFrequency* begin() const { return first; }
+    const TermFrequency* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+};
+
+// Document -> (term, tf) entries. All documents share one pooled buffer; a
+// document owns a contiguous run of it sorted by term id. Runs freed by Remove
+// are reclaimed by Compact, which runs automatically once they outnumber the
+// live entries.
+class ForwardIndex {
+
+public:
+
+    explicit ForwardIndex(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    // entries must be sorted by term and free of duplicates.
+    void Add(int document_id, const std::vector<TermFrequency>& entries);
+
+    void Remove(int document_id);
+
+    // Throws std::out_of_range for unknown documents. Invalidated by Add, Remove and Compact.
+    TermFrequencyRange Get(int document_id) const;
+
+    void Compact();
+
+private:
+    struct Run
+    {
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    std::pmr::vector<TermFrequency> entries_;
+    std::pmr::map<int, Run> runs_;
+    size_t free_entries_ = 0;
+};
+
+// Read-only view of a document's word frequencies, ordered by term id.
+// Iterating yields std::pair<std::string_view, double> values.
+class WordFrequenciesView {
+
+public:
+
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<std::string_view, double>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        Iterator(const TermFrequency* it, const TermDictionary* dictionary) : it_(it), dictionary_(dictionary) {}
+
+        value_type operator*() const { return {dictionary_->GetTerm(it_->term), it_->tf}; }
+        Iterator& operator++() { ++it_; return *this; }
+        Iterator operator++(int) { Iterator copy = *this; ++it_; return copy; }
+        bool operator==(const Iterator& other) const { return it_ == other.it_; }
+        bool operator!=(const Iterator& other) const { return it_ != other.it_; }
+
+    private:
+        const TermFrequency* it_;
+        const TermDictionary* dictionary_;
+    };
+
+    WordFrequenciesView(TermFrequencyRange entries, const TermDictionary& dictionary) : entries_(entries), dictionary_(&dictionary) {}
+
+    Iterator begin() const { return {entries_.begin(), dictionary_}; }
+    Iterator end() const { return {entries_.end(), dictionary_}; }
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.size() == 0; }
+
+private:
+    TermFrequencyRange entries_;
+    const TermDictionary* dictionary_;
+};
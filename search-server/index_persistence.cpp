@@ -0,0 +1,721 @@
+#include "index_persistence.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+const std::array<uint32_t, 256> CRC_TABLE = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        }
+        table[i] = c;
+    }
+    return table;
+}();
+
+const char CHECKPOINT_MAGIC[] = {'S', 'S', 'C', 'P'};
+const uint64_t CHECKPOINT_VERSION = 1;
+const size_t RECORD_HEADER_SIZE = 8;
+
+void PutFixed32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void PutFixed64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void PutVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void PutSigned(std::string& out, int64_t value) {
+    PutVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void PutString(std::string& out, std::string_view value) {
+    PutVarint(out, value.size());
+    out.append(value);
+}
+
+// Decoders consume the front of `in` and return false on truncated or malformed input.
+bool GetFixed32(std::string_view& in, uint32_t& value) {
+    if (in.size() < 4) { return false; }
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    in.remove_prefix(4);
+    return true;
+}
+
+bool GetFixed64(std::string_view& in, uint64_t& value) {
+    if (in.size() < 8) { return false; }
+    value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    in.remove_prefix(8);
+    return true;
+}
+
+bool GetVarint(std::string_view& in, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+        const auto byte = static_cast<unsigned char>(in.front());
+        in.remove_prefix(1);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) { return true; }
+    }
+    return false;
+}
+
+bool GetSigned(std::string_view& in, int64_t& value) {
+    uint64_t raw = 0;
+    if (!GetVarint(in, raw)) { return false; }
+    value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+    return true;
+}
+
+bool GetString(std::string_view& in, std::string_view& value) {
+    uint64_t size = 0;
+    if (!GetVarint(in, size) || in.size() < size) { return false; }
+    value = in.substr(0, size);
+    in.remove_prefix(size);
+    return true;
+}
+
+std::string EncodeRecord(const WalRecord& record) {
+    std::string payload;
+    PutVarint(payload, record.lsn);
+    payload.push_back(static_cast<char>(record.operation));
+    PutSigned(payload, record.document.id);
+    if (record.operation == WalOperation::ADD) {
+        payload.push_back(static_cast<char>(record.document.status));
+        PutVarint(payload, record.document.ratings.size());
+        for (int rating : record.document.ratings) {
+            PutSigned(payload, rating);
+        }
+        PutString(payload, record.document.text);
+        if (!record.replaced_ids.empty()) {
+            PutVarint(payload, record.replaced_ids.size());
+            for (int id : record.replaced_ids) {
+                PutSigned(payload, id);
+            }
+        }
+    }
+    std::string framed;
+    framed.reserve(RECORD_HEADER_SIZE + payload.size());
+    PutFixed32(framed, static_cast<uint32_t>(payload.size()));
+    PutFixed32(framed, Crc32(payload));
+    framed += payload;
+    return framed;
+}
+
+bool DecodeRecord(std::string_view payload, WalRecord& record) {
+    int64_t id = 0;
+    if (!GetVarint(payload, record.lsn) || payload.empty()) { return false; }
+    record.operation = static_cast<WalOperation>(payload.front());
+    payload.remove_prefix(1);
+    if (!GetSigned(payload, id)) { return false; }
+    record.document.id = static_cast<int>(id);
+    if (record.operation == WalOperation::REMOVE) {
+        return payload.empty();
+    }
+    if (record.operation != WalOperation::ADD || payload.empty()) { return false; }
+    record.document.status = static_cast<DocumentStatus>(payload.front());
+    payload.remove_prefix(1);
+    uint64_t rating_count = 0;
+    if (!GetVarint(payload, rating_count) || rating_count > payload.size()) { return false; }
+    record.document.ratings.resize(rating_count);
+    for (int& rating : record.document.ratings) {
+        int64_t value = 0;
+        if (!GetSigned(payload, value)) { return false; }
+        rating = static_cast<int>(value);
+    }
+    std::string_view text;
+    if (!GetString(payload, text)) { return false; }
+    record.document.text = std::string{text};
+    if (payload.empty()) {
+        return true;
+    }
+    uint64_t replaced_count = 0;
+    if (!GetVarint(payload, replaced_count) || replaced_count > payload.size()) { return false; }
+    record.replaced_ids.resize(replaced_count);
+    for (int& replaced_id : record.replaced_ids) {
+        if (!GetSigned(payload, id)) { return false; }
+        replaced_id = static_cast<int>(id);
+    }
+    return payload.empty();
+}
+
+std::string ReadFile(int fd) {
+    std::string content;
+    char buffer[1 << 16];
+    while (true) {
+        const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            throw std::runtime_error(std::string("WAL read failed: ") + std::strerror(errno));
+        }
+        if (n == 0) { break; }
+        content.append(buffer, static_cast<size_t>(n));
+    }
+    return content;
+}
+
+void SyncDirectory(const std::string& file_path) {
+    const auto directory = std::filesystem::path(file_path).parent_path();
+    const int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+}  // namespace
+
+uint32_t Crc32(std::string_view data) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (char c : data) {
+        crc = CRC_TABLE[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+WriteAheadLog::WriteAheadLog(std::string path, WalOptions options) : path_(std::move(path)), options_(options) {
+    if (options_.group_commit_size == 0) {
+        throw std::invalid_argument("Group commit size must be positive");
+    }
+    if (options_.max_commit_delay.count() < 0) {
+        throw std::invalid_argument("Commit delay must not be negative");
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (flusher_.joinable()) {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        flush_signal_.notify_all();
+        flusher_.join();
+    }
+    if (fd_ < 0) {
+        return;
+    }
+    try {
+        Commit();
+    } catch (...) {
+    }
+    ::close(fd_);
+}
+
+std::vector<WalRecord> WriteAheadLog::Recover(uint64_t after_lsn) {
+    std::lock_guard lock(mutex_);
+    if (fd_ >= 0) {
+        throw std::logic_error("WAL is already open");
+    }
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Cannot open WAL " + path_ + ": " + std::strerror(errno));
+    }
+
+    const std::string content = ReadFile(fd_);
+    std::string_view rest = content;
+    std::vector<WalRecord> records;
+    last_lsn_ = after_lsn;
+    while (rest.size() >= RECORD_HEADER_SIZE) {
+        std::string_view header = rest;
+        uint32_t size = 0;
+        uint32_t crc = 0;
+        GetFixed32(header, size);
+        GetFixed32(header, crc);
+        if (header.size() < size) { break; }
+        const std::string_view payload = header.substr(0, size);
+        WalRecord record;
+        if (Crc32(payload) != crc || !DecodeRecord(payload, record)) { break; }
+        rest.remove_prefix(RECORD_HEADER_SIZE + size);
+        last_lsn_ = std::max(last_lsn_, record.lsn);
+        if (record.lsn > after_lsn) {
+            records.push_back(std::move(record));
+        }
+    }
+    durable_lsn_ = last_lsn_;
+    committed_size_ = content.size() - rest.size();
+
+    // Whatever follows the last intact record is a torn write; cut it so new records append cleanly.
+    if (!rest.empty() && ::ftruncate(fd_, static_cast<off_t>(committed_size_)) != 0) {
+        throw std::runtime_error("Cannot truncate WAL " + path_ + ": " + std::strerror(errno));
+    }
+    if (options_.fsync_policy != FsyncPolicy::EVERY_RECORD && options_.max_commit_delay.count() > 0) {
+        flusher_ = std::thread([this] { FlushLoop(); });
+    }
+    return records;
+}
+
+uint64_t WriteAheadLog::Append(WalOperation operation, const DocumentData& document, const std::vector<int>& replaced_ids) {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock lock(mutex_);
+    if (fd_ < 0) {
+        throw std::logic_error("WAL must be recovered before appending");
+    }
+    CheckNotFailed();
+
+    WalRecord record;
+    record.lsn = last_lsn_ + 1;
+    record.operation = operation;
+    record.document.id = document.id;
+    if (operation == WalOperation::ADD) {
+        record.document = document;
+        record.replaced_ids = replaced_ids;
+    }
+    const bool first_pending = pending_.empty();
+    pending_ += EncodeRecord(record);
+    ++pending_records_;
+    last_lsn_ = record.lsn;
+    ++stats_.records;
+
+    if (options_.fsync_policy == FsyncPolicy::EVERY_RECORD || pending_records_ >= options_.group_commit_size) {
+        CommitLocked();
+    } else if (first_pending) {
+        oldest_pending_ = start;
+        flush_signal_.notify_one();
+    }
+
+    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    stats_.total_append_latency += latency;
+    stats_.max_append_latency = std::max(stats_.max_append_latency, latency);
+    return record.lsn;
+}
+
+void WriteAheadLog::Commit() {
+    std::lock_guard lock(mutex_);
+    CommitLocked();
+}
+
+void WriteAheadLog::WaitDurable(uint64_t lsn) {
+    std::lock_guard lock(mutex_);
+    if (durable_lsn_ < lsn) {
+        CommitLocked();
+    }
+}
+
+void WriteAheadLog::CommitLocked() {
+    CheckNotFailed();
+    if (pending_.empty()) {
+        return;
+    }
+    std::string_view data = pending_;
+    while (!data.empty()) {
+        const ssize_t n = ::write(fd_, data.data(), data.size());
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            Fail(std::string("write failed: ") + std::strerror(errno));
+        }
+        data.remove_prefix(static_cast<size_t>(n));
+    }
+    if (options_.fsync_policy != FsyncPolicy::NONE) {
+        const auto start = std::chrono::steady_clock::now();
+        if (::fsync(fd_) != 0) {
+            Fail(std::string("fsync failed: ") + std::strerror(errno));
+        }
+        stats_.total_sync_latency += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    }
+    committed_size_ += pending_.size();
+    durable_lsn_ = last_lsn_;
+    stats_.bytes += pending_.size();
+    ++stats_.commits;
+    pending_.clear();
+    pending_records_ = 0;
+}
+
+void WriteAheadLog::CheckNotFailed() const {
+    if (!failure_.empty()) {
+        throw std::runtime_error("WAL " + path_ + " is unusable after an earlier " + failure_);
+    }
+}
+
+// Drops the pending group and cuts a partially written one off the file.
+void WriteAheadLog::Fail(const std::string& reason) {
+    failure_ = reason;
+    pending_.clear();
+    pending_records_ = 0;
+    last_lsn_ = durable_lsn_;
+    if (::ftruncate(fd_, static_cast<off_t>(committed_size_)) != 0) {
+        failure_ += ", truncation failed: " + std::string(std::strerror(errno));
+    }
+    throw std::runtime_error("WAL " + path_ + " " + failure_);
+}
+
+void WriteAheadLog::FlushLoop() {
+    std::unique_lock lock(mutex_);
+    while (!stopping_) {
+        if (pending_.empty() || !failure_.empty()) {
+            flush_signal_.wait(lock);
+            continue;
+        }
+        const auto due = oldest_pending_ + options_.max_commit_delay;
+        const uint64_t waiting_lsn = last_lsn_;
+        if (flush_signal_.wait_until(lock, due, [this, waiting_lsn] { return stopping_ || durable_lsn_ >= waiting_lsn; })) {
+            continue;
+        }
+        try {
+            CommitLocked();
+        } catch (const std::exception&) {
+            // The log is now failed; the next Append or Commit reports it.
+        }
+    }
+}
+
+void WriteAheadLog::Reset() {
+    std::lock_guard lock(mutex_);
+    CheckNotFailed();
+    pending_.clear();
+    pending_records_ = 0;
+    if (::ftruncate(fd_, 0) != 0 || (options_.fsync_policy != FsyncPolicy::NONE && ::fsync(fd_) != 0)) {
+        Fail(std::string("reset failed: ") + std::strerror(errno));
+    }
+    committed_size_ = 0;
+    durable_lsn_ = last_lsn_;
+}
+
+uint64_t WriteAheadLog::GetLastLsn() const {
+    std::lock_guard lock(mutex_);
+    return last_lsn_;
+}
+
+uint64_t WriteAheadLog::GetDurableLsn() const {
+    std::lock_guard lock(mutex_);
+    return durable_lsn_;
+}
+
+WalWriteStats WriteAheadLog::GetWriteStats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+void WriteCheckpoint(const std::string& path, uint64_t lsn, const SearchServer& search_server) {
+    std::string body;
+    PutVarint(body, CHECKPOINT_VERSION);
+    PutVarint(body, lsn);
+    PutVarint(body, static_cast<uint64_t>(search_server.GetDocumentCount()));
+    for (auto it = search_server.begin(); it != search_server.end(); ++it) {
+        const Document doc = search_server.GetDocument(*it);
+        const auto& word_freqs = search_server.GetWordFrequencies(*it);
+        PutSigned(body, doc.id);
+        body.push_back(static_cast<char>(doc.status));
+        PutSigned(body, doc.rating);
+        PutVarint(body, word_freqs.size());
+        for (const auto& [word, tf] : word_freqs) {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &tf, sizeof(bits));
+            PutString(body, word);
+            PutFixed64(body, bits);
+        }
+    }
+
+    std::string content(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    PutFixed32(content, Crc32(body));
+    content += body;
+
+    const std::string temp_path = path + ".tmp";
+    const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create checkpoint " + temp_path + ": " + std::strerror(errno));
+    }
+    std::string_view rest = content;
+    while (!rest.empty()) {
+        const ssize_t n = ::write(fd, rest.data(), rest.size());
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0) {
+            ::close(fd);
+            throw std::runtime_error(std::string("Checkpoint write failed: ") + std::strerror(errno));
+        }
+        rest.remove_prefix(static_cast<size_t>(n));
+    }
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot install checkpoint " + path + ": " + std::strerror(errno));
+    }
+    SyncDirectory(path);
+}
+
+uint64_t LoadCheckpoint(const std::string& path, SearchServer& search_server) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) { return 0; }
+        throw std::runtime_error("Cannot open checkpoint " + path + ": " + std::strerror(errno));
+    }
+    std::string content;
+    try {
+        content = ReadFile(fd);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    const auto corrupted = [&path] { return std::runtime_error("Checkpoint " + path + " is corrupted"); };
+    std::string_view in = content;
+    uint32_t crc = 0;
+    if (in.substr(0, sizeof(CHECKPOINT_MAGIC)) != std::string_view(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))) { throw corrupted(); }
+    in.remove_prefix(sizeof(CHECKPOINT_MAGIC));
+    if (!GetFixed32(in, crc) || Crc32(in) != crc) { throw corrupted(); }
+
+    uint64_t version = 0;
+    uint64_t lsn = 0;
+    uint64_t document_count = 0;
+    if (!GetVarint(in, version) || version != CHECKPOINT_VERSION || !GetVarint(in, lsn) || !GetVarint(in, document_count)) { throw corrupted(); }
+
+    for (uint64_t i = 0; i < document_count; ++i) {
+        int64_t id = 0;
+        int64_t rating = 0;
+        uint64_t word_count = 0;
+        if (!GetSigned(in, id) || in.empty()) { throw corrupted(); }
+        const auto status = static_cast<DocumentStatus>(in.front());
+        in.remove_prefix(1);
+        if (!GetSigned(in, rating) || !GetVarint(in, word_count)) { throw corrupted(); }
+        std::map<std::string_view, double> word_freqs;
+        for (uint64_t w = 0; w < word_count; ++w) {
+            std::string_view word;
+            uint64_t bits = 0;
+            if (!GetString(in, word) || !GetFixed64(in, bits)) { throw corrupted(); }
+            double tf = 0.0;
+            std::memcpy(&tf, &bits, sizeof(tf));
+            word_freqs[word] = tf;
+        }
+        search_server.RestoreDocument(static_cast<int>(id), status, static_cast<int>(rating), word_freqs);
+    }
+    return lsn;
+}
+
+namespace {
+
+// Lifts the duplicate policy and the memory budget while mutations that were
+// already accepted once are re-applied (recovery, rollback), restoring them after.
+class AcceptedMutations {
+public:
+    explicit AcceptedMutations(SearchServer& search_server)
+        : search_server_(search_server)
+        , duplicate_options_(search_server.GetDuplicateOptions())
+        , memory_budget_(search_server.GetMemoryBudget())
+    {
+        DuplicateOptions keep = duplicate_options_;
+        keep.policy = DuplicatePolicy::KEEP;
+        search_server_.SetDuplicateOptions(keep);
+        search_server_.SetMemoryBudget(0);
+    }
+
+    ~AcceptedMutations() {
+        search_server_.SetDuplicateOptions(duplicate_options_);
+        search_server_.SetMemoryBudget(memory_budget_);
+    }
+
+    AcceptedMutations(const AcceptedMutations&) = delete;
+    AcceptedMutations& operator=(const AcceptedMutations&) = delete;
+
+private:
+    SearchServer& search_server_;
+    DuplicateOptions duplicate_options_;
+    size_t memory_budget_;
+};
+
+}  // namespace
+
+DurableIndex::DurableIndex(SearchServer& search_server, const std::string& directory, WalOptions options)
+    : search_server_(search_server)
+    , checkpoint_path_((std::filesystem::create_directories(directory), directory + "/index.checkpoint"))
+    , options_(options)
+    , wal_(directory + "/index.wal", options)
+{
+    const AcceptedMutations accepted(search_server_);
+    const uint64_t checkpoint_lsn = LoadCheckpoint(checkpoint_path_, search_server_);
+    const std::vector<WalRecord> tail = wal_.Recover(checkpoint_lsn);
+    Replay(tail);
+    recovered_records_ = tail.size();
+    records_since_checkpoint_ = tail.size();
+}
+
+uint64_t DurableIndex::AddDocument(int document_id, const std::string_view& document, DocumentStatus status, const std::vector<int>& ratings) {
+    // Documents REPLACE is about to remove are saved for a rollback and logged
+    // with the addition, so recovery does not depend on the policy in effect then.
+    UncommittedMutation mutation;
+    if (search_server_.GetDuplicateOptions().policy == DuplicatePolicy::REPLACE) {
+        for (const int id : search_server_.FindNearDuplicates(document)) {
+            mutation.removed.push_back(TakeSnapshot(id));
+        }
+    }
+    // The index validates the document first, so an invalid document is never logged.
+    search_server_.AddDocument(document_id, document, status, ratings);
+    mutation.added_id = document_id;
+    DocumentData data;
+    data.id = document_id;
+    data.text = std::string{document};
+    data.status = status;
+    data.ratings = ratings;
+    std::vector<int> replaced_ids;
+    for (const DocumentSnapshot& snapshot : mutation.removed) {
+        replaced_ids.push_back(snapshot.document.id);
+    }
+    try {
+        mutation.lsn = wal_.Append(WalOperation::ADD, data, replaced_ids);
+    } catch (...) {
+        Undo(mutation);
+        RollBackUncommitted();
+        throw;
+    }
+    const uint64_t lsn = mutation.lsn;
+    uncommitted_.push_back(std::move(mutation));
+    ForgetCommitted();
+    MaybeCheckpoint();
+    return lsn;
+}
+
+uint64_t DurableIndex::RemoveDocument(int document_id) {
+    if (std::find(search_server_.begin(), search_server_.end(), document_id) == search_server_.end()) {
+        return 0;
+    }
+    UncommittedMutation mutation;
+    mutation.removed.push_back(TakeSnapshot(document_id));
+    search_server_.RemoveDocument(document_id);
+    DocumentData data;
+    data.id = document_id;
+    try {
+        mutation.lsn = wal_.Append(WalOperation::REMOVE, data);
+    } catch (...) {
+        Undo(mutation);
+        RollBackUncommitted();
+        throw;
+    }
+    const uint64_t lsn = mutation.lsn;
+    uncommitted_.push_back(std::move(mutation));
+    ForgetCommitted();
+    MaybeCheckpoint();
+    return lsn;
+}
+
+void DurableIndex::WaitDurable(uint64_t lsn) {
+    try {
+        wal_.WaitDurable(lsn);
+    } catch (...) {
+        RollBackUncommitted();
+        throw;
+    }
+    ForgetCommitted();
+}
+
+void DurableIndex::Sync() {
+    try {
+        wal_.Commit();
+    } catch (...) {
+        RollBackUncommitted();
+        throw;
+    }
+    ForgetCommitted();
+}
+
+void DurableIndex::Checkpoint() {
+    Sync();
+    WriteCheckpoint(checkpoint_path_, wal_.GetLastLsn(), search_server_);
+    wal_.Reset();
+    records_since_checkpoint_ = 0;
+}
+
+size_t DurableIndex::GetRecoveredRecordCount() const {
+    return recovered_records_;
+}
+
+WalWriteStats DurableIndex::GetWriteStats() const {
+    return wal_.GetWriteStats();
+}
+
+void DurableIndex::Replay(const std::vector<WalRecord>& records) {
+    // Consecutive additions are tokenized in parallel; removals act as barriers to keep log order.
+    std::vector<DocumentData> batch;
+    for (const WalRecord& record : records) {
+        if (record.operation == WalOperation::ADD) {
+            batch.push_back(record.document);
+            if (record.replaced_ids.empty()) {
+                continue;
+            }
+        }
+        search_server_.AddDocuments(std::execution::par, batch);
+        batch.clear();
+        if (record.operation == WalOperation::REMOVE) {
+            search_server_.RemoveDocument(record.document.id);
+        }
+        for (const int id : record.replaced_ids) {
+            search_server_.RemoveDocument(id);
+        }
+    }
+    search_server_.AddDocuments(std::execution::par, batch);
+}
+
+DurableIndex::DocumentSnapshot DurableIndex::TakeSnapshot(int document_id) const {
+    DocumentSnapshot snapshot;
+    snapshot.document = search_server_.GetDocument(document_id);
+    for (const auto& [word, tf] : search_server_.GetWordFrequencies(document_id)) {
+        snapshot.word_freqs.emplace_back(std::string{word}, tf);
+    }
+    return snapshot;
+}
+
+void DurableIndex::RestoreSnapshot(const DocumentSnapshot& snapshot) {
+    std::map<std::string_view, double> word_freqs;
+    for (const auto& [word, tf] : snapshot.word_freqs) {
+        word_freqs.emplace(word, tf);
+    }
+    search_server_.RestoreDocument(snapshot.document.id, snapshot.document.status, snapshot.document.rating, word_freqs);
+}
+
+void DurableIndex::Undo(const UncommittedMutation& mutation) {
+    const AcceptedMutations accepted(search_server_);
+    if (mutation.added_id) {
+        search_server_.RemoveDocument(*mutation.added_id);
+    }
+    for (const DocumentSnapshot& snapshot : mutation.removed) {
+        RestoreSnapshot(snapshot);
+    }
+}
+
+void DurableIndex::ForgetCommitted() {
+    const uint64_t durable_lsn = wal_.GetDurableLsn();
+    const auto committed_end = std::find_if(uncommitted_.begin(), uncommitted_.end(),
+        [durable_lsn](const UncommittedMutation& mutation) { return mutation.lsn > durable_lsn; });
+    uncommitted_.erase(uncommitted_.begin(), committed_end);
+}
+
+// A failed log has dropped everything after its durable lsn.
+void DurableIndex::RollBackUncommitted() {
+    ForgetCommitted();
+    for (auto it = uncommitted_.rbegin(); it != uncommitted_.rend(); ++it) {
+        Undo(*it);
+    }
+    uncommitted_.clear();
+}
+
+void DurableIndex::MaybeCheckpoint() {
+    if (options_.checkpoint_interval != 0 && ++records_since_checkpoint_ >= options_.checkpoint_interval) {
+        Checkpoint();
+    }
+}
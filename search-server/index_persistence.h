@@ -0,0 +1,197 @@
+#pragma once
+#include "document.h"
+#include "search_server.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <string_view>
+#include <vector>
+
+// When appended records are forced to stable storage.
+enum class FsyncPolicy
+{
+    NONE,          // records reach the OS page cache on commit, fsync is left to the OS
+    GROUP,         // one fsync per group commit
+    EVERY_RECORD   // every record is written and fsync'ed before Append returns
+};
+
+// Under NONE and GROUP, Append returns before the record is durable. A group
+// is committed once group_commit_size records are pending, or by a background
+// flusher once its oldest record has waited max_commit_delay (0 disables the
+// flusher), or explicitly by Commit/WaitDurable. A crash therefore loses at
+// most the acknowledged records of the last max_commit_delay.
+struct WalOptions
+{
+    FsyncPolicy fsync_policy = FsyncPolicy::GROUP;
+    size_t group_commit_size = 32;
+    std::chrono::milliseconds max_commit_delay{10};
+    size_t checkpoint_interval = 10000;
+};
+
+enum class WalOperation : uint8_t
+{
+    ADD = 1,
+    REMOVE = 2
+};
+
+struct WalRecord
+{
+    uint64_t lsn = 0;
+    WalOperation operation = WalOperation::ADD;
+    DocumentData document;   // only document.id is meaningful for REMOVE
+    // ADD only: near-duplicates the addition removed under DuplicatePolicy::REPLACE.
+    // They share the record so recovery applies both or neither.
+    std::vector<int> replaced_ids;
+};
+
+struct WalWriteStats
+{
+    size_t records = 0;
+    size_t commits = 0;
+    size_t bytes = 0;
+    std::chrono::nanoseconds total_append_latency{0};
+    std::chrono::nanoseconds max_append_latency{0};
+    std::chrono::nanoseconds total_sync_latency{0};
+};
+
+uint32_t Crc32(std::string_view data);
+
+// Append-only binary log of index mutations. Each record is framed as
+// [payload size][crc32 of payload][payload], so a torn tail left by a crash is
+// detected on Recover and cut off. A failed write or fsync truncates the file
+// back to the last committed record and puts the log in a failed state: every
+// later Append or Commit throws std::runtime_error, so no record is ever
+// written after a torn one.
+class WriteAheadLog {
+
+public:
+
+    WriteAheadLog(std::string path, WalOptions options);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Reads every intact record with lsn > after_lsn and opens the log for appending.
+    std::vector<WalRecord> Recover(uint64_t after_lsn);
+
+    uint64_t Append(WalOperation operation, const DocumentData& document, const std::vector<int>& replaced_ids = {});
+
+    void Commit();
+
+    // Returns once every record up to lsn is committed, committing the pending group if needed.
+    void WaitDurable(uint64_t lsn);
+
+    // Drops all records, used right after a checkpoint made them redundant.
+    void Reset();
+
+    uint64_t GetLastLsn() const;
+
+    // Highest lsn whose record has been committed.
+    uint64_t GetDurableLsn() const;
+
+    WalWriteStats GetWriteStats() const;
+
+private:
+    std::string path_;
+    WalOptions options_;
+    int fd_ = -1;
+    std::string pending_;
+    size_t pending_records_ = 0;
+    std::chrono::steady_clock::time_point oldest_pending_;
+    uint64_t last_lsn_ = 0;
+    uint64_t durable_lsn_ = 0;
+    uint64_t committed_size_ = 0;   // file size up to the last committed record
+    std::string failure_;
+    WalWriteStats stats_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable flush_signal_;
+    bool stopping_ = false;
+    std::thread flusher_;
+
+    void CommitLocked();
+    void CheckNotFailed() const;
+    void Fail(const std::string& reason);
+    void FlushLoop();
+};
+
+// Checkpoints are full snapshots of the index, written to a temporary file and
+// atomically renamed over the previous one. They store the lsn of the last
+// mutation they include.
+void WriteCheckpoint(const std::string& path, uint64_t lsn, const SearchServer& search_server);
+
+// Returns the lsn stored in the checkpoint, or 0 when there is no checkpoint yet.
+uint64_t LoadCheckpoint(const std::string& path, SearchServer& search_server);
+
+// SearchServer front-end that makes AddDocument/RemoveDocument durable.
+// Construction recovers the index from the latest checkpoint plus the WAL tail,
+// with the duplicate policy and memory budget of the server lifted: logged
+// mutations were accepted under the options of their time and replay exactly.
+// A mutation is applied to the index first and then logged. Mutations return
+// their lsn: under FsyncPolicy NONE or GROUP they are acknowledged before they
+// are durable, see WalOptions, and the index keeps what it needs to undo them
+// until the log commits them. When the log fails it drops every uncommitted
+// record, so the index rolls back every uncommitted mutation, newest first,
+// and the exception is rethrown. A failure of the background flusher surfaces
+// in the next AddDocument, RemoveDocument, WaitDurable, Sync or Checkpoint;
+// until then the index still holds the mutations that failure dropped.
+// An exception from the automatic checkpoint that follows a mutation leaves it
+// applied and logged.
+class DurableIndex {
+
+public:
+
+    DurableIndex(SearchServer& search_server, const std::string& directory, WalOptions options = {});
+
+    uint64_t AddDocument(int document_id, const std::string_view& document, DocumentStatus status, const std::vector<int>& ratings);
+
+    // Returns 0 and logs nothing when the document is not indexed.
+    uint64_t RemoveDocument(int document_id);
+
+    void WaitDurable(uint64_t lsn);
+
+    void Sync();
+
+    void Checkpoint();
+
+    size_t GetRecoveredRecordCount() const;
+
+    WalWriteStats GetWriteStats() const;
+
+private:
+    // Everything RestoreDocument needs to put a removed document back.
+    struct DocumentSnapshot
+    {
+        Document document;
+        std::vector<std::pair<std::string, double>> word_freqs;
+    };
+
+    // How to undo a logged mutation the log has not committed yet.
+    struct UncommittedMutation
+    {
+        uint64_t lsn = 0;
+        std::optional<int> added_id;
+        std::vector<DocumentSnapshot> removed;
+    };
+
+    SearchServer& search_server_;
+    std::string checkpoint_path_;
+    WalOptions options_;
+    WriteAheadLog wal_;
+    size_t records_since_checkpoint_ = 0;
+    size_t recovered_records_ = 0;
+    std::vector<UncommittedMutation> uncommitted_;
+
+    DocumentSnapshot TakeSnapshot(int document_id) const;
+    void RestoreSnapshot(const DocumentSnapshot& snapshot);
+    void Undo(const UncommittedMutation& mutation);
+    void ForgetCommitted();
+    void RollBackUncommitted();
+    void Replay(const std::vector<WalRecord>& records);
+    void MaybeCheckpoint();
+};
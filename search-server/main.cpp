@@ -1,7 +1,10 @@
+#include "index_persistence.h"
 #include "process_queries.h"
 #include "search_server.h"
 #include "log_duration.h"
+#include "test_example_functions.h"
 #include <execution>
+#include <filesystem>
 #include <iostream>
 #include <random>
 #include <string>
@@ -49,6 +52,21 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
     }
     return queries;
 }
+// Every copy_every-th document becomes an earlier document plus one word: a planted near-duplicate.
+vector<string> PlantNearDuplicates(mt19937& generator, vector<string> documents, const vector<string>& dictionary, size_t copy_every) {
+    for (size_t i = copy_every - 1; i < documents.size(); i += copy_every) {
+        documents[i] = documents[uniform_int_distribution<size_t>(0, i - 1)(generator)] + ' '
+            + dictionary[uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+    }
+    return documents;
+}
+SearchServer MakeSearchServer(const string& stop_words, const vector<string>& documents) {
+    SearchServer search_server(stop_words);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    return search_server;
+}
 template <typename ExecutionPolicy>
 void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
     LOG_DURATION(mark);
@@ -60,17 +78,108 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     }
     cout << total_relevance << endl;
 }
+template <typename Processor>
+void TestProcessor(string_view mark, const SearchServer& search_server, const vector<string>& queries, Processor processor) {
+    LOG_DURATION(mark);
+    double total_relevance = 0;
+    for (const auto& documents : processor(search_server, queries)) {
+        for (const auto& document : documents) {
+            total_relevance += document.relevance;
+        }
+    }
+    cout << total_relevance << endl;
+}
+void TestCompiled(string_view mark, const SearchServer& search_server, const vector<SearchServer::CompiledQuery>& queries) {
+    LOG_DURATION(mark);
+    double total_relevance = 0;
+    for (const auto& query : queries) {
+        for (const auto& document : search_server.FindTopDocuments(query)) {
+            total_relevance += document.relevance;
+        }
+    }
+    cout << total_relevance << endl;
+}
+template <typename ExecutionPolicy>
+void TestNearDuplicateGroups(string_view mark, const SearchServer& search_server, ExecutionPolicy&& policy) {
+    LOG_DURATION(mark);
+    size_t duplicates = 0;
+    for (const auto& group : search_server.FindNearDuplicateGroups(policy)) {
+        duplicates += group.size() - 1;
+    }
+    cout << duplicates << endl;
+}
+template <typename ExecutionPolicy>
+void TestRemoveNearDuplicates(string_view mark, SearchServer search_server, ExecutionPolicy&& policy) {
+    LOG_DURATION(mark);
+    cout << search_server.RemoveNearDuplicates(policy).size() << endl;
+}
+void TestDurability(string_view mark, const vector<string>& documents, FsyncPolicy fsync_policy) {
+    const auto directory = filesystem::temp_directory_path() / "search_server_durability";
+    filesystem::remove_all(directory);
+    WalOptions options;
+    options.fsync_policy = fsync_policy;
+    options.checkpoint_interval = 0;
+    WalWriteStats stats;
+    {
+        LOG_DURATION(mark);
+        SearchServer search_server("and with"s);
+        DurableIndex index(search_server, directory.string(), options);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            index.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+        }
+        index.Sync();
+        stats = index.GetWriteStats();
+    }
+    using chrono::duration_cast;
+    using chrono::microseconds;
+    cout << stats.records << " records, " << stats.commits << " commits, append avg "
+         << duration_cast<microseconds>(stats.total_append_latency).count() / max<size_t>(stats.records, 1) << " us, max "
+         << duration_cast<microseconds>(stats.max_append_latency).count() << " us, sync total "
+         << duration_cast<chrono::milliseconds>(stats.total_sync_latency).count() << " ms" << endl;
+    filesystem::remove_all(directory);
+}
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 int main() {
+    TestSearchServer();
 
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
     const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
-    SearchServer search_server(dictionary[0]);
-    for (size_t i = 0; i < documents.size(); ++i) {
-        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
-    }
+    SearchServer search_server = MakeSearchServer(dictionary[0], documents);
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
     TEST(seq);
     TEST(par);
+
+    TestProcessor("ProcessQueries"sv, search_server, queries, ProcessQueries);
+    TestProcessor("ProcessQueriesBatched"sv, search_server, queries, ProcessQueriesBatched);
+
+    vector<SearchServer::CompiledQuery> compiled_queries;
+    for (const auto& query : queries) {
+        compiled_queries.push_back(search_server.CompileQuery(query));
+    }
+    TestCompiled("compiled queries"sv, search_server, compiled_queries);
+    // Same documents, newer index version: every compiled query is refreshed before it runs.
+    search_server.AddDocument(documents.size(), documents.front(), DocumentStatus::ACTUAL, {1, 2, 3});
+    search_server.RemoveDocument(documents.size());
+    TestCompiled("stale compiled queries"sv, search_server, compiled_queries);
+
+    const vector<string> planted_documents = PlantNearDuplicates(generator, vector<string>(documents.begin(), documents.begin() + 5'000), dictionary, 10);
+    const SearchServer planted_server = MakeSearchServer(dictionary[0], planted_documents);
+    TestNearDuplicateGroups("near-duplicate groups seq"sv, planted_server, execution::seq);
+    TestNearDuplicateGroups("near-duplicate groups par"sv, planted_server, execution::par);
+    TestRemoveNearDuplicates("remove near-duplicates seq"sv, MakeSearchServer(dictionary[0], planted_documents), execution::seq);
+    TestRemoveNearDuplicates("remove near-duplicates par"sv, MakeSearchServer(dictionary[0], planted_documents), execution::par);
+
+    const vector<string> logged_documents(documents.begin(), documents.begin() + 2'000);
+    TestDurability("durable adds, fsync none"sv, logged_documents, FsyncPolicy::NONE);
+    TestDurability("durable adds, fsync group"sv, logged_documents, FsyncPolicy::GROUP);
+    TestDurability("durable adds, fsync every record"sv, logged_documents, FsyncPolicy::EVERY_RECORD);
+
+    FuzzyOptions fuzzy;
+    fuzzy.max_distance = 1;
+    search_server.SetFuzzyOptions(fuzzy);
+    Test("fuzzy distance 1"sv, search_server, queries, execution::seq);
+    fuzzy.max_distance = 2;
+    search_server.SetFuzzyOptions(fuzzy);
+    Test("fuzzy distance 2"sv, search_server, queries, execution::seq);
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "near_duplicates.h"
+#include <stdexcept>
+
+namespace near_duplicates_detail {
+
+// FNV-1a: fixed across platforms and runs, unlike std::hash.
+uint64_t HashWord(std::string_view word) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const char c : word) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+LshKeys BandKeys(const std::array<uint64_t, MINHASH_SIGNATURE_SIZE>& signature) {
+    constexpr size_t rows = MINHASH_SIGNATURE_SIZE / LSH_BAND_COUNT;
+    static_assert(rows * LSH_BAND_COUNT == MINHASH_SIGNATURE_SIZE);
+    // Keys are truncated to 32 bits: a collision only adds a candidate, which verification drops.
+    LshKeys keys;
+    for (size_t band = 0; band < LSH_BAND_COUNT; ++band) {
+        uint64_t key = Mix(band);
+        for (size_t row = 0; row < rows; ++row) {
+            key = Mix(key ^ signature[band * rows + row]);
+        }
+        keys[band] = static_cast<uint32_t>(key);
+    }
+    return keys;
+}
+
+}  // namespace near_duplicates_detail
+
+double ComputeJaccard(TermFrequencyRange lhs, TermFrequencyRange rhs) {
+    if (lhs.size() == 0 && rhs.size() == 0) {
+        return 1.0;
+    }
+    size_t common = 0;
+    auto lhs_it = lhs.begin();
+    auto rhs_it = rhs.begin();
+    while (lhs_it != lhs.end() && rhs_it != rhs.end()) {
+        if (lhs_it->term < rhs_it->term) {
+            ++lhs_it;
+        } else if (rhs_it->term < lhs_it->term) {
+            ++rhs_it;
+        } else {
+            ++common;
+            ++lhs_it;
+            ++rhs_it;
+        }
+    }
+    return static_cast<double>(common) / static_cast<double>(lhs.size() + rhs.size() - common);
+}
+
+NearDuplicateIndex::NearDuplicateIndex(std::pmr::memory_resource* resource)
+    : bands_(LSH_BAND_COUNT, resource)
+{
+}
+
+void NearDuplicateIndex::Add(int document_id, const LshKeys& keys) {
+    for (size_t band = 0; band < LSH_BAND_COUNT; ++band) {
+        bands_[band].emplace(keys[band], document_id);
+    }
+}
+
+void NearDuplicateIndex::Remove(int document_id, const LshKeys& keys) {
+    for (size_t band = 0; band < LSH_BAND_COUNT; ++band) {
+        auto [first, last] = bands_[band].equal_range(keys[band]);
+        for (; first != last; ++first) {
+            if (first->second == document_id) {
+                bands_[band].erase(first);
+                break;
+            }
+        }
+    }
+}
+
+std::vector<int> NearDuplicateIndex::FindCandidates(const LshKeys& keys) const {
+    std::vector<int> candidates;
+    for (size_t band = 0; band < LSH_BAND_COUNT; ++band) {
+        const auto [first, last] = bands_[band].equal_range(keys[band]);
+        for (auto it = first; it != last; ++it) {
+            candidates.push_back(it->second);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    return candidates;
+}
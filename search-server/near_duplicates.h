@@ -0,0 +1,89 @@
+#pragma once
+#include "forward_index.h"
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// MinHash signature length and its split into LSH bands of MINHASH_SIGNATURE_SIZE / LSH_BAND_COUNT rows.
+// Two documents become candidates when all rows of some band agree, which for
+// Jaccard similarity J happens with probability 1 - (1 - J^4)^8: about 0.98 at
+// J = 0.8, 0.40 at J = 0.5 and 0.01 at J = 0.2.
+const size_t MINHASH_SIGNATURE_SIZE = 32;
+const size_t LSH_BAND_COUNT = 8;
+
+using LshKeys = std::array<uint32_t, LSH_BAND_COUNT>;
+
+// Hashes the MinHash signature of a word set into one key per band. Repeated
+// words do not change the result. Hashes depend only on the word text, so keys
+// can be computed before the words are interned. Accepts a range of
+// string_views or of (string_view, value) pairs such as word frequencies.
+template <typename Words>
+LshKeys ComputeLshKeys(const Words& words);
+
+// |lhs ∩ rhs| / |lhs ∪ rhs| over the terms of two term-sorted ranges, by a linear merge.
+double ComputeJaccard(TermFrequencyRange lhs, TermFrequencyRange rhs);
+
+// Locality-sensitive hash index over document signatures. Keys are not stored
+// per document; callers recompute them for Remove.
+class NearDuplicateIndex {
+
+public:
+
+    explicit NearDuplicateIndex(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    void Add(int document_id, const LshKeys& keys);
+
+    // keys must be the ones the document was added with.
+    void Remove(int document_id, const LshKeys& keys);
+
+    // Sorted ids of the documents sharing at least one band with keys.
+    std::vector<int> FindCandidates(const LshKeys& keys) const;
+
+private:
+    // One table per band: band key -> documents.
+    std::pmr::vector<std::pmr::unordered_multimap<uint32_t, int>> bands_;
+};
+
+
+namespace near_duplicates_detail {
+
+uint64_t HashWord(std::string_view word);
+
+LshKeys BandKeys(const std::array<uint64_t, MINHASH_SIGNATURE_SIZE>& signature);
+
+inline uint64_t Mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline std::string_view GetWord(std::string_view word) {
+    return word;
+}
+
+template <typename Word, typename Value>
+std::string_view GetWord(const std::pair<Word, Value>& word_with_value) {
+    return word_with_value.first;
+}
+
+}  // namespace near_duplicates_detail
+
+template <typename Words>
+LshKeys ComputeLshKeys(const Words& words) {
+    using namespace near_duplicates_detail;
+    std::array<uint64_t, MINHASH_SIGNATURE_SIZE> signature;
+    signature.fill(std::numeric_limits<uint64_t>::max());
+    for (const auto& word : words) {
+        const uint64_t hash = HashWord(GetWord(word));
+        for (size_t i = 0; i < MINHASH_SIGNATURE_SIZE; ++i) {
+            signature[i] = std::min(signature[i], Mix(hash ^ Mix(i)));
+        }
+    }
+    return BandKeys(signature);
+}
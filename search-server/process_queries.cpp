@@ -9,6 +9,10 @@ std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_ser
     return result;
 }
 
+std::vector<std::vector<Document>> ProcessQueriesBatched(const SearchServer& search_server, const std::vector<std::string>& queries) {
+    return search_server.FindTopDocumentsBatch(queries);
+}
+
 std::list <Document> ProcessQueriesJoined (const SearchServer& search_server, const std::vector<std::string>& queries) {
     const auto vec = ProcessQueries(search_server,queries);
     std::list<Document> result;
@@ -11,7 +11,7 @@ public:
 RequestQueue(const SearchServer& search_server);
 
 template <typename DocumentPredicate>
-std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
+std::vector<Document> AddFindRequest(const std::string& raw_query, const DocumentPredicate& document_predicate);
 
 std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
 
@@ -33,7 +33,7 @@ struct QueryResult {
 };
 
 template <typename DocumentPredicate>
-std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
+std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, const DocumentPredicate& document_predicate) {
     RequestQueue::QueryResult temp_qr;
     temp_qr.found_ = RequestQueue::SearchServer_.FindTopDocuments(raw_query,document_predicate);
     temp_qr.query_ = raw_query;
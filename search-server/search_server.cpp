@@ -5,10 +5,105 @@
 #include "search_server.h"
 #include <set>
 #include <execution>
+#include <iterator>
+#include <utility>
+
+SearchServer::SearchServer(const std::string& stop_words, std::pmr::memory_resource* resource) : SearchServer::SearchServer(SplitIntoWords(stop_words), resource){}
+
+SearchServer::SearchServer(const std::string_view& stop_words, std::pmr::memory_resource* resource) : SearchServer::SearchServer(SplitIntoWords(stop_words), resource){}
+
+SearchServer::MemoryResources::MemoryResources(std::pmr::memory_resource* upstream)
+    : documents(upstream)
+    , inverted_index(upstream)
+    , forward_index(upstream)
+    , dictionary(upstream)
+    , stop_words(upstream)
+    , near_duplicates(upstream)
+    , upstream(upstream)
+    , thread_safe(upstream->is_equal(*std::pmr::new_delete_resource())
+                  || dynamic_cast<std::pmr::synchronized_pool_resource*>(upstream) != nullptr)
+{
+}
+
+namespace {
+
+// pmr containers keep their allocator on assignment, so a member that has to
+// allocate from other resources is destroyed and move-constructed in place;
+// the move constructor adopts value's allocator and does not throw.
+template <typename Member>
+void Recreate(Member& member, Member&& value) noexcept {
+    member.~Member();
+    new (&member) Member(std::move(value));
+}
+
+}  // namespace
+
+SearchServer::SearchServer(SearchServer&& other)
+    : memory_(std::move(other.memory_))
+    , id_to_all_parameters_(std::move(other.id_to_all_parameters_))
+    , term_to_document_freqs_(std::move(other.term_to_document_freqs_))
+    , stop_words_(std::move(other.stop_words_))
+    , all_docs_ids_(std::move(other.all_docs_ids_))
+    , forward_index_(std::move(other.forward_index_))
+    , dictionary_(std::move(other.dictionary_))
+    , near_duplicates_(std::move(other.near_duplicates_))
+    , document_count_(other.document_count_)
+    , fuzzy_options_(other.fuzzy_options_)
+    , server_id_(std::exchange(other.server_id_, NextServerId()))
+    , index_version_(other.index_version_)
+    , duplicate_options_(other.duplicate_options_)
+    , memory_budget_(other.memory_budget_)
+    , max_pending_queries_(other.max_pending_queries_)
+{
+    other.ResetIndex(memory_->upstream);
+}
+
+SearchServer& SearchServer::operator=(SearchServer&& other) {
+    if (this == &other) {
+        return *this;
+    }
+    TakeIndex(other);
+    document_count_ = other.document_count_;
+    fuzzy_options_ = other.fuzzy_options_;
+    server_id_ = std::exchange(other.server_id_, NextServerId());
+    index_version_ = other.index_version_;
+    duplicate_options_ = other.duplicate_options_;
+    memory_budget_ = other.memory_budget_;
+    max_pending_queries_ = other.max_pending_queries_;
+    other.ResetIndex(memory_->upstream);
+    return *this;
+}
+
+// The old containers release their memory into the old resources before
+// those are replaced.
+void SearchServer::TakeIndex(SearchServer& other) {
+    Recreate(id_to_all_parameters_, std::move(other.id_to_all_parameters_));
+    Recreate(term_to_document_freqs_, std::move(other.term_to_document_freqs_));
+    Recreate(stop_words_, std::move(other.stop_words_));
+    Recreate(all_docs_ids_, std::move(other.all_docs_ids_));
+    Recreate(forward_index_, std::move(other.forward_index_));
+    Recreate(dictionary_, std::move(other.dictionary_));
+    Recreate(near_duplicates_, std::move(other.near_duplicates_));
+    memory_ = std::move(other.memory_);
+}
 
-SearchServer::SearchServer(const std::string& stop_words) : SearchServer::SearchServer(SplitIntoWords(stop_words)){}
+void SearchServer::ResetIndex(std::pmr::memory_resource* upstream) {
+    auto memory = std::make_unique<MemoryResources>(upstream);
+    Recreate(id_to_all_parameters_, std::pmr::map<int, Document>(&memory->documents));
+    Recreate(term_to_document_freqs_, std::pmr::vector<std::pmr::map<int, double>>(&memory->inverted_index));
+    Recreate(stop_words_, TermDictionary(&memory->stop_words));
+    Recreate(all_docs_ids_, std::pmr::set<int>(&memory->documents));
+    Recreate(forward_index_, ForwardIndex(&memory->forward_index));
+    Recreate(dictionary_, TermDictionary(&memory->dictionary));
+    Recreate(near_duplicates_, NearDuplicateIndex(&memory->near_duplicates));
+    memory_ = std::move(memory);
+    document_count_ = 0;
+    ++index_version_;
+}
 
-SearchServer::SearchServer(const std::string_view& stop_words) : SearchServer::SearchServer(SplitIntoWords(stop_words)){}
+size_t MemoryUsage::Total() const {
+    return documents + inverted_index + forward_index + dictionary + stop_words + near_duplicates;
+}
 
 int SearchServer::GetDocumentCount() const {
     return SearchServer::document_count_;
@@ -17,55 +112,483 @@ int SearchServer::GetDocumentCount() const {
 
 
 void SearchServer::AddDocument(int document_id, const std::string_view& document, DocumentStatus status, const std::vector<int>& ratings) {
+    CheckNewDocumentId(document_id);
+
+    const std::vector<std::string_view> words = SplitIntoWordsNoStop(document);
+
+    for (const auto& w : words) {
+        if (!IsValidWord(w)) { throw std::invalid_argument("Text of document include incorrect symbols");}
+    }
+    const std::map<std::string_view, double> word_freqs = ComputeWordFrequencies(words);
+    const LshKeys keys = ComputeLshKeys(words);
+    const std::vector<int> replaced = CheckNearDuplicates(word_freqs, keys);
+    IndexDocument(document_id, status, ComputeAverageRating(ratings), word_freqs, keys);
+    for (const int id : replaced) {
+        RemoveDocument(id);
+    }
+}
+
+void SearchServer::AddDocuments(const std::execution::sequenced_policy&, const std::vector<DocumentData>& documents) {
+    for (const DocumentData& doc : documents) {
+        AddDocument(doc.id, doc.text, doc.status, doc.ratings);
+    }
+}
+
+void SearchServer::AddDocuments(const std::execution::parallel_policy&, const std::vector<DocumentData>& documents) {
+    // Exceptions must not escape a parallel algorithm, so validity is only recorded here and reported below.
+    struct Tokenized {
+        std::vector<std::string_view> words;
+        LshKeys keys;
+        bool valid = true;
+    };
+    std::vector<Tokenized> tokenized(documents.size());
+    std::transform(std::execution::par, documents.begin(), documents.end(), tokenized.begin(), [this](const DocumentData& doc) {
+        Tokenized t;
+        t.words = SplitIntoWordsNoStop(doc.text);
+        t.valid = std::all_of(t.words.begin(), t.words.end(), [this](std::string_view word) {return IsValidWord(word);});
+        t.keys = ComputeLshKeys(t.words);
+        return t;
+    });
+
+    for (size_t i = 0; i < documents.size(); ++i) {
+        CheckNewDocumentId(documents[i].id);
+        if (!tokenized[i].valid) { throw std::invalid_argument("Text of document include incorrect symbols");}
+        const std::map<std::string_view, double> word_freqs = ComputeWordFrequencies(tokenized[i].words);
+        const std::vector<int> replaced = CheckNearDuplicates(word_freqs, tokenized[i].keys);
+        IndexDocument(documents[i].id, documents[i].status, ComputeAverageRating(documents[i].ratings), word_freqs, tokenized[i].keys);
+        for (const int id : replaced) {
+            RemoveDocument(id);
+        }
+    }
+}
+
+void SearchServer::RestoreDocument(int document_id, DocumentStatus status, int rating, const std::map<std::string_view, double>& word_freqs) {
+    CheckNewDocumentId(document_id);
+    for (const auto& [word, tf] : word_freqs) {
+        if (word.empty() || !IsValidWord(word)) { throw std::invalid_argument("Text of document include incorrect symbols");}
+    }
+    IndexDocument(document_id, status, rating, word_freqs, ComputeLshKeys(word_freqs));
+}
+
+Document SearchServer::GetDocument(int document_id) const {
+    return id_to_all_parameters_.at(document_id);
+}
+
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentStatus status) const {
+    return FindTopDocumentsAsync(std::move(raw_query), deadline, std::move(token), StatusIs{status});
+}
+
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(CompiledQuery query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentStatus status) const {
+    return FindTopDocumentsAsync(std::move(query), deadline, std::move(token), StatusIs{status});
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const {
+    // Exceptions must not escape a parallel algorithm, so parse errors are rethrown afterwards.
+    struct Parsed {
+        Query query;
+        std::exception_ptr error;
+    };
+    std::vector<Parsed> parsed(raw_queries.size());
+    std::transform(std::execution::par, raw_queries.begin(), raw_queries.end(), parsed.begin(), [this](const std::string& raw_query) {
+        Parsed p;
+        try {
+            p.query = ParseQuery(raw_query);
+        } catch (...) {
+            p.error = std::current_exception();
+        }
+        return p;
+    });
+    std::vector<const Query*> queries;
+    queries.reserve(parsed.size());
+    for (const Parsed& p : parsed) {
+        if (p.error) {
+            std::rethrow_exception(p.error);
+        }
+        queries.push_back(&p.query);
+    }
+    return EvaluateBatch(queries);
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<CompiledQuery>& queries) const {
+    // Stale queries are refreshed into their own slot, so the pointers stay valid.
+    std::vector<Query> recompiled(queries.size());
+    std::vector<const Query*> current(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        if (IsCurrent(queries[i])) {
+            current[i] = &queries[i].query_;
+        } else {
+            recompiled[i] = RefreshQuery(queries[i]);
+            current[i] = &recompiled[i];
+        }
+    }
+    return EvaluateBatch(current);
+}
+
+std::vector<std::vector<Document>> SearchServer::EvaluateBatch(const std::vector<const Query*>& queries) const {
+    // Ascending term order per query matches the summation order of FindTopDocuments.
+    struct TermUse {
+        TermId term;
+        size_t query;
+        double weight;   // the term's idf_weight in that query
+    };
+    std::vector<TermUse> plus_uses;
+    std::vector<TermUse> minus_uses;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        for (const QueryTerm& term : queries[i]->plus_terms_) {
+            plus_uses.push_back({term.id, i, term.idf_weight});
+        }
+        for (TermId term : queries[i]->minus_terms_) {
+            minus_uses.push_back({term, i, 0.0});
+        }
+    }
+    const auto by_term = [](const TermUse& lhs, const TermUse& rhs) {
+        return lhs.term < rhs.term || (lhs.term == rhs.term && lhs.query < rhs.query);
+    };
+    std::sort(std::execution::par, plus_uses.begin(), plus_uses.end(), by_term);
+    std::sort(std::execution::par, minus_uses.begin(), minus_uses.end(), by_term);
+
+    // Contributions are appended per query rather than summed into maps: the scatter
+    // stays sequential writes, and each query is reduced on its own afterwards.
+    std::vector<std::vector<std::pair<int, double>>> contributions(queries.size());
+    std::vector<std::vector<int>> excluded(queries.size());
+    for (auto group_begin = plus_uses.begin(); group_begin != plus_uses.end();) {
+        const TermId term = group_begin->term;
+        const auto group_end = std::find_if(group_begin, plus_uses.end(), [term](const TermUse& use) {return use.term != term;});
+        const auto& ID_with_TF = GetPostings(term);
+        if (!ID_with_TF.empty()) {
+            for (const auto& [id, tf] : ID_with_TF) {
+                for (auto it = group_begin; it != group_end; ++it) {
+                    contributions[it->query].emplace_back(id, it->weight * tf);
+                }
+            }
+        }
+        group_begin = group_end;
+    }
+    for (auto group_begin = minus_uses.begin(); group_begin != minus_uses.end();) {
+        const TermId term = group_begin->term;
+        const auto group_end = std::find_if(group_begin, minus_uses.end(), [term](const TermUse& use) {return use.term != term;});
+        for (const auto& [id, tf] : GetPostings(term)) {
+            for (auto it = group_begin; it != group_end; ++it) {
+                excluded[it->query].push_back(id);
+            }
+        }
+        group_begin = group_end;
+    }
+
+    std::vector<size_t> indexes(queries.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::vector<std::vector<Document>> result(queries.size());
+    std::transform(std::execution::par, indexes.begin(), indexes.end(), result.begin(), [this, &contributions, &excluded](size_t i) {
+        // A stable sort keeps each document's contributions in term order, so the sums are bit-identical.
+        auto& query_contributions = contributions[i];
+        std::stable_sort(query_contributions.begin(), query_contributions.end(), [](const auto& lhs, const auto& rhs) {return lhs.first < rhs.first;});
+        std::sort(excluded[i].begin(), excluded[i].end());
+        std::vector<std::pair<int, double>> document_to_relevance;
+        for (const auto& [id, value] : query_contributions) {
+            if (!document_to_relevance.empty() && document_to_relevance.back().first == id) {
+                document_to_relevance.back().second += value;
+            } else if (!std::binary_search(excluded[i].begin(), excluded[i].end(), id)) {
+                document_to_relevance.emplace_back(id, value);
+            }
+        }
+        std::vector<Document> documents = SelectDocuments(document_to_relevance, StatusIs{DocumentStatus::ACTUAL});
+        SortAndTruncate(std::execution::seq, documents);
+        return documents;
+    });
+    return result;
+}
+
+void SearchServer::SetMaxPendingQueries(size_t count) {
+    max_pending_queries_ = count;
+}
+
+SearchServer::QueryInterrupt::QueryInterrupt(CancellationToken token, std::chrono::steady_clock::time_point deadline)
+    : token_(std::move(token)), deadline_(deadline) {}
+
+bool SearchServer::QueryInterrupt::operator()() const {
+    if (triggered_.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    if (token_.IsCancelled() || std::chrono::steady_clock::now() >= deadline_) {
+        triggered_.store(true, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool SearchServer::QueryInterrupt::IsTriggered() const {
+    return triggered_.load(std::memory_order_relaxed);
+}
+
+void SearchServer::SetFuzzyOptions(const FuzzyOptions& options) {
+    if (options.max_distance < 0 || options.max_expansions_per_word < 0 || options.max_expansions_per_query < 0) {
+        throw std::invalid_argument("Fuzzy search limits must not be negative");
+    }
+    fuzzy_options_ = options;
+    ++index_version_;
+}
+
+void SearchServer::SetDuplicateOptions(const DuplicateOptions& options) {
+    if (!(options.min_similarity > 0.0 && options.min_similarity <= 1.0)) {
+        throw std::invalid_argument("Near-duplicate similarity must be in (0, 1]");
+    }
+    duplicate_options_ = options;
+}
+
+const DuplicateOptions& SearchServer::GetDuplicateOptions() const {
+    return duplicate_options_;
+}
+
+std::vector<int> SearchServer::FindNearDuplicates(int document_id) const {
+    const TermFrequencyRange entries = forward_index_.Get(document_id);
+    if (entries.size() == 0) {
+        return {};
+    }
+    return FindNearDuplicates(ComputeLshKeys(GetWordFrequencies(document_id)), entries, document_id);
+}
+
+std::vector<int> SearchServer::FindNearDuplicates(std::string_view document) const {
+    const std::vector<std::string_view> words = SplitIntoWordsNoStop(document);
+    for (const auto& w : words) {
+        if (!IsValidWord(w)) { throw std::invalid_argument("Text of document include incorrect symbols");}
+    }
+    std::vector<int> duplicates = FindNearDuplicates(ComputeWordFrequencies(words), ComputeLshKeys(words));
+    std::sort(duplicates.begin(), duplicates.end());
+    return duplicates;
+}
+
+std::vector<int> SearchServer::FindNearDuplicates(const LshKeys& keys, TermFrequencyRange entries, int exclude_id) const {
+    std::vector<int> duplicates;
+    for (const int id : near_duplicates_.FindCandidates(keys)) {
+        if (id != exclude_id && ComputeJaccard(entries, forward_index_.Get(id)) >= duplicate_options_.min_similarity) {
+            duplicates.push_back(id);
+        }
+    }
+    return duplicates;
+}
+
+std::vector<int> SearchServer::CheckNearDuplicates(const std::map<std::string_view, double>& word_freqs, const LshKeys& keys) const {
+    if (duplicate_options_.policy == DuplicatePolicy::KEEP) {
+        return {};
+    }
+    std::vector<int> duplicates = FindNearDuplicates(word_freqs, keys);
+    if (!duplicates.empty() && duplicate_options_.policy == DuplicatePolicy::REJECT) {
+        throw std::invalid_argument("Document is a near-duplicate of document " + std::to_string(duplicates.front()));
+    }
+    return duplicates;
+}
+
+std::vector<int> SearchServer::FindNearDuplicates(const std::map<std::string_view, double>& word_freqs, const LshKeys& keys) const {
+    if (word_freqs.empty()) {
+        return {};
+    }
+    // Words missing from the dictionary get ids past its end: no document
+    // shares them, but they still count towards the union.
+    std::vector<TermFrequency> entries;
+    entries.reserve(word_freqs.size());
+    TermId unknown = static_cast<TermId>(dictionary_.Size());
+    for (const auto& [word, tf] : word_freqs) {
+        const auto term = dictionary_.Find(word);
+        entries.push_back({term ? *term : unknown++, tf});
+    }
+    std::sort(entries.begin(), entries.end(), [](const TermFrequency& lhs, const TermFrequency& rhs) {
+        return lhs.term < rhs.term;
+    });
+    return FindNearDuplicates(keys, {entries.data(), entries.data() + entries.size()}, -1);
+}
+
+template <typename Policy>
+std::vector<std::vector<int>> SearchServer::FindNearDuplicatePairs(const Policy& policy, const std::vector<int>& ids) const {
+    std::vector<std::vector<int>> pairs(ids.size());
+    std::transform(policy, ids.begin(), ids.end(), pairs.begin(), [this](int id) {
+        std::vector<int> duplicates = FindNearDuplicates(id);
+        duplicates.erase(duplicates.begin(), std::upper_bound(duplicates.begin(), duplicates.end(), id));
+        return duplicates;
+    });
+    return pairs;
+}
+
+namespace {
+
+// Union-find over positions in ids (sorted), linked by the near-duplicate pairs.
+std::vector<std::vector<int>> GroupNearDuplicates(const std::vector<int>& ids, const std::vector<std::vector<int>>& pairs) {
+    std::vector<size_t> parent(ids.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    const auto find_root = [&parent](size_t i) {
+        while (parent[i] != i) {
+            i = parent[i] = parent[parent[i]];
+        }
+        return i;
+    };
+    for (size_t i = 0; i < ids.size(); ++i) {
+        for (const int duplicate : pairs[i]) {
+            const size_t j = std::lower_bound(ids.begin(), ids.end(), duplicate) - ids.begin();
+            const size_t lhs = find_root(i);
+            const size_t rhs = find_root(j);
+            parent[std::max(lhs, rhs)] = std::min(lhs, rhs);
+        }
+    }
+    // Roots are the smallest position of their component, so groups come out ordered by first id.
+    std::vector<std::vector<int>> groups;
+    std::vector<size_t> group_of_root(ids.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const size_t root = find_root(i);
+        if (root == i) {
+            continue;
+        }
+        if (group_of_root[root] == ids.size()) {
+            group_of_root[root] = groups.size();
+            groups.push_back({ids[root]});
+        }
+        groups[group_of_root[root]].push_back(ids[i]);
+    }
+    return groups;
+}
+
+// Documents that are near-duplicates of an earlier document not itself redundant.
+std::set<int> SelectRedundantDocuments(const std::vector<int>& ids, const std::vector<std::vector<int>>& pairs) {
+    std::set<int> redundant;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (redundant.count(ids[i]) == 0) {
+            redundant.insert(pairs[i].begin(), pairs[i].end());
+        }
+    }
+    return redundant;
+}
+
+}  // namespace
+
+std::vector<std::vector<int>> SearchServer::FindNearDuplicateGroups(const std::execution::sequenced_policy& policy) const {
+    const std::vector<int> ids(all_docs_ids_.begin(), all_docs_ids_.end());
+    return GroupNearDuplicates(ids, FindNearDuplicatePairs(policy, ids));
+}
+
+std::vector<std::vector<int>> SearchServer::FindNearDuplicateGroups(const std::execution::parallel_policy& policy) const {
+    const std::vector<int> ids(all_docs_ids_.begin(), all_docs_ids_.end());
+    return GroupNearDuplicates(ids, FindNearDuplicatePairs(policy, ids));
+}
+
+std::vector<int> SearchServer::RemoveNearDuplicates(const std::execution::sequenced_policy& policy) {
+    const std::vector<int> ids(all_docs_ids_.begin(), all_docs_ids_.end());
+    const std::set<int> removed = SelectRedundantDocuments(ids, FindNearDuplicatePairs(policy, ids));
+    for (const int id : removed) {
+        RemoveDocument(id);
+    }
+    return {removed.begin(), removed.end()};
+}
+
+std::vector<int> SearchServer::RemoveNearDuplicates(const std::execution::parallel_policy& policy) {
+    const std::vector<int> ids(all_docs_ids_.begin(), all_docs_ids_.end());
+    const std::set<int> removed = SelectRedundantDocuments(ids, FindNearDuplicatePairs(policy, ids));
+    for (const int id : removed) {
+        RemoveDocument(policy, id);
+    }
+    return {removed.begin(), removed.end()};
+}
+
+void SearchServer::CheckNewDocumentId(int document_id) const {
     if ( document_id < 0 ) {
             throw std::invalid_argument("ID less than zero");
     }
     if (id_to_all_parameters_.count(document_id) != 0 ) {
          throw std::invalid_argument("ID of document already exists");
     }
+}
 
-    const std::vector<std::string_view> words = SplitIntoWordsNoStop(document);
-
-    for (const auto& w : words) {
-        if (!IsValidWord(w)) { throw std::invalid_argument("Text of document include incorrect symbols");}
+std::map<std::string_view, double> SearchServer::ComputeWordFrequencies(const std::vector<std::string_view>& words) const {
+    std::map<std::string_view, double> word_freqs;
+    const double tf_single = 1.0 / words.size();
+    for (std::string_view word : words) {
+        word_freqs[word] += tf_single;
     }
+    return word_freqs;
+}
+
+void SearchServer::IndexDocument(int document_id, DocumentStatus status, int rating, const std::map<std::string_view, double>& word_freqs, const LshKeys& keys) {
+    CheckMemoryBudget();
     all_docs_ids_.insert(document_id);
     ++SearchServer::document_count_;
+    ++index_version_;
     Document q;
     q.id = document_id;
     q.status = status;
-    q.rating = ComputeAverageRating(ratings);
+    q.rating = rating;
 
     id_to_all_parameters_.insert({document_id, q});
 
-    double tf_single = 1.0 / words.size();
-    
-    std::set<std::string_view> w;
-
-    for (std::string_view word : words) {
-        std::string original{word};
-        all_document_words_[document_id].push_back(original);
-        word_to_document_freqs_[std::string_view{all_document_words_[document_id].back()}][document_id] += tf_single;
-        word_freq_[document_id][std::string_view{all_document_words_[document_id].back()}]+= tf_single;
-        w.insert(std::string_view{all_document_words_[document_id].back()});
+    std::vector<TermFrequency> entries;
+    entries.reserve(word_freqs.size());
+    for (const auto& [word, tf] : word_freqs) {
+        const TermId term = dictionary_.Add(word);
+        if (term >= term_to_document_freqs_.size()) {
+            term_to_document_freqs_.resize(term + 1);
+        }
+        term_to_document_freqs_[term][document_id] += tf;
+        entries.push_back({term, tf});
+    }
+    std::sort(entries.begin(), entries.end(), [](const TermFrequency& lhs, const TermFrequency& rhs) {
+        return lhs.term < rhs.term;
+    });
+    forward_index_.Add(document_id, entries);
+    // Empty documents all share one signature; indexing them would build a single huge bucket.
+    if (!entries.empty()) {
+        near_duplicates_.Add(document_id, keys);
     }
-    id_doc_words_[document_id] = w;
 }
 
-const std::set<int>::iterator SearchServer::begin() {
+const std::pmr::set<int>::iterator SearchServer::begin() {
     return all_docs_ids_.begin();
 }
 
-const std::set<int>::iterator SearchServer::end() {
+const std::pmr::set<int>::iterator SearchServer::end() {
     return all_docs_ids_.end();
 }
 
-std::map<int,std::set<std::string_view>>& SearchServer::GetIdToWords() {
-    return id_doc_words_;
+std::pmr::set<int>::const_iterator SearchServer::begin() const {
+    return all_docs_ids_.begin();
+}
+
+std::pmr::set<int>::const_iterator SearchServer::end() const {
+    return all_docs_ids_.end();
 }
 
-const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    return SearchServer::word_freq_.at(document_id);
+WordFrequenciesView SearchServer::GetWordFrequencies(int document_id) const {
+    return WordFrequenciesView(forward_index_.Get(document_id), dictionary_);
+}
+
+MemoryUsage SearchServer::GetMemoryUsage() const {
+    MemoryUsage usage;
+    usage.documents = memory_->documents.GetAllocatedBytes();
+    usage.inverted_index = memory_->inverted_index.GetAllocatedBytes();
+    usage.forward_index = memory_->forward_index.GetAllocatedBytes();
+    usage.dictionary = memory_->dictionary.GetAllocatedBytes();
+    usage.stop_words = memory_->stop_words.GetAllocatedBytes();
+    usage.near_duplicates = memory_->near_duplicates.GetAllocatedBytes();
+    return usage;
+}
+
+void SearchServer::SetMemoryBudget(size_t bytes) {
+    memory_budget_ = bytes;
+}
+
+size_t SearchServer::GetMemoryBudget() const {
+    return memory_budget_;
+}
+
+void SearchServer::Compact() {
+    dictionary_.Compact();
+    forward_index_.Compact();
+    term_to_document_freqs_.shrink_to_fit();
+}
+
+void SearchServer::CheckMemoryBudget() {
+    if (memory_budget_ == 0 || GetMemoryUsage().Total() < memory_budget_) {
+        return;
+    }
+    Compact();
+    if (GetMemoryUsage().Total() >= memory_budget_) {
+        throw std::length_error("Memory budget of the index is exhausted");
+    }
 }
 
 void SearchServer::RemoveDocument(int document_id) {
@@ -74,16 +597,15 @@ void SearchServer::RemoveDocument(int document_id) {
   }
   id_to_all_parameters_.erase(document_id);
  
-  std::vector<const std::string_view*> word_pointers(word_freq_[document_id].size()); 
-  std::transform(word_freq_[document_id].begin(), word_freq_[document_id].end(), word_pointers.begin(), [document_id, this](auto&  str_rate) {return &str_rate.first;});
-  std::for_each(word_pointers.begin(), word_pointers.end(),[document_id, this] (auto &word) {
-      word_to_document_freqs_.at(*word).erase(document_id);
+  const TermFrequencyRange entries = forward_index_.Get(document_id);
+  std::for_each(entries.begin(), entries.end(),[document_id, this] (const TermFrequency& entry) {
+      term_to_document_freqs_[entry.term].erase(document_id);
   });
-  word_freq_.erase(document_id);
+  near_duplicates_.Remove(document_id, ComputeLshKeys(GetWordFrequencies(document_id)));
+  forward_index_.Remove(document_id);
   all_docs_ids_.erase(document_id);
-  id_doc_words_.erase(document_id);
-  all_document_words_.erase(document_id);
   --document_count_;
+  ++index_version_;
  }
 
 
@@ -93,21 +615,24 @@ void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int d
 
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
+  if (!memory_->thread_safe) {
+      return SearchServer::RemoveDocument(document_id);
+  }
   if (std::find(std::execution::par, all_docs_ids_.begin(), all_docs_ids_.end(), document_id) == all_docs_ids_.end()) {
       return;
   }
   id_to_all_parameters_.erase(document_id);
     
-  std::vector<const std::string_view*> word_pointers(word_freq_[document_id].size()); 
-  std::transform(std::execution::par, word_freq_[document_id].begin(), word_freq_[document_id].end(), word_pointers.begin(), [document_id, this](auto&  str_rate) {return &str_rate.first;});
-  std::for_each(std::execution::par, word_pointers.begin(), word_pointers.end(),[document_id, this] (auto &word) {
-      word_to_document_freqs_.at(*word).erase(document_id);
+  // Entries hold distinct terms, so every task erases from a different posting list.
+  const TermFrequencyRange entries = forward_index_.Get(document_id);
+  std::for_each(std::execution::par, entries.begin(), entries.end(),[document_id, this] (const TermFrequency& entry) {
+      term_to_document_freqs_[entry.term].erase(document_id);
   });
-  word_freq_.erase(document_id);
+  near_duplicates_.Remove(document_id, ComputeLshKeys(GetWordFrequencies(document_id)));
+  forward_index_.Remove(document_id);
   all_docs_ids_.erase(document_id);
-  id_doc_words_.erase(document_id);
-  all_document_words_.erase(document_id);
   --document_count_;
+  ++index_version_;
  }
 
 
@@ -121,28 +646,11 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
     return MatchDocument(raw_query, document_id);
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy&, const std::string_view& raw_query, int document_id) const {
-    
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy& policy, const std::string_view& raw_query, int document_id) const {
     if (all_docs_ids_.count(document_id) == 0) {
         throw std::out_of_range("Incorrect ID");
     }
-    
-    SearchServer::Query q = SearchServer::ParseQuery(raw_query, false);
-
-    if (std::any_of(q.minus_words_.begin(), q.minus_words_.end(),[document_id, this](const auto& word){return (word_to_document_freqs_.count(word) != 0 && word_to_document_freqs_.at(word).count(document_id)!= 0);})) {
-        return std::make_tuple (std::vector<std::string_view>{},SearchServer::id_to_all_parameters_.at(document_id).status);
-    }
-    
-    std::vector<std::string_view> tuple_pl_words(q.plus_words_.size());
-    
-    auto it = std::copy_if(std::execution::par, q.plus_words_.begin(), q.plus_words_.end(), tuple_pl_words.begin(), [document_id,this](auto& word){
-        return (word_to_document_freqs_.count(word) != 0 && word_to_document_freqs_.at(word).count(document_id)!= 0);
-     });
-    
-    std::sort(std::execution::par, tuple_pl_words.begin(),it);
-    auto it_end = unique(std::execution::par, tuple_pl_words.begin(), it);
-    tuple_pl_words.erase(it_end, tuple_pl_words.end());
-    return std::make_tuple(tuple_pl_words,SearchServer::id_to_all_parameters_.at(document_id).status);
+    return MatchQuery(policy, ParseQuery(raw_query), document_id);
 }
 
 
@@ -150,53 +658,243 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
     if (all_docs_ids_.count(document_id) == 0) {
         throw std::out_of_range("Incorrect ID");
     } 
+    return MatchQuery(std::execution::seq, ParseQuery(raw_query), document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const CompiledQuery& query, int document_id) const {
+    return MatchDocument(std::execution::seq, query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy& policy, const CompiledQuery& query, int document_id) const {
+    if (all_docs_ids_.count(document_id) == 0) {
+        throw std::out_of_range("Incorrect ID");
+    }
+    return WithCurrentQuery(query, [this, &policy, document_id](const Query& q) {return MatchQuery(policy, q, document_id);});
+}
 
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy& policy, const CompiledQuery& query, int document_id) const {
+    if (all_docs_ids_.count(document_id) == 0) {
+        throw std::out_of_range("Incorrect ID");
+    }
+    return WithCurrentQuery(query, [this, &policy, document_id](const Query& q) {return MatchQuery(policy, q, document_id);});
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchQuery(const std::execution::sequenced_policy&, const Query& q, int document_id) const {
     std::vector<std::string_view> tuple_pl_words;
-    SearchServer::Query q = SearchServer::ParseQuery(raw_query, true);
-    
-    if (std::any_of(std::execution::seq, q.minus_words_.begin(), q.minus_words_.end(),[document_id, this](const auto& word){return (word_to_document_freqs_.count(word) != 0 && word_to_document_freqs_.at(word).count(document_id)!= 0);})) {
+    if (std::any_of(std::execution::seq, q.minus_terms_.begin(), q.minus_terms_.end(),[document_id, this](TermId term){return DocumentHasTerm(term, document_id);})) {
         return std::make_tuple (tuple_pl_words,SearchServer::id_to_all_parameters_.at(document_id).status);
     }
     
-    for(const auto& pw : q.plus_words_) {
-        if ( SearchServer::word_to_document_freqs_.count(pw) != 0 && SearchServer::word_to_document_freqs_.at(pw).count(document_id) != 0 ) {
-            tuple_pl_words.push_back(pw);
+    for(const QueryTerm& term : q.plus_terms_) {
+        if (DocumentHasTerm(term.id, document_id)) {
+            tuple_pl_words.push_back(dictionary_.GetTerm(term.id));
         }
     }
      std::sort(std::execution::seq, tuple_pl_words.begin(),tuple_pl_words.end());
     return std::make_tuple(tuple_pl_words,SearchServer::id_to_all_parameters_.at(document_id).status);
 }
 
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchQuery(const std::execution::parallel_policy&, const Query& q, int document_id) const {
+    if (std::any_of(q.minus_terms_.begin(), q.minus_terms_.end(),[document_id, this](TermId term){return DocumentHasTerm(term, document_id);})) {
+        return std::make_tuple (std::vector<std::string_view>{},SearchServer::id_to_all_parameters_.at(document_id).status);
+    }
+    
+    std::vector<QueryTerm> matched_terms(q.plus_terms_.size());
+    
+    auto it = std::copy_if(std::execution::par, q.plus_terms_.begin(), q.plus_terms_.end(), matched_terms.begin(), [document_id,this](const QueryTerm& term){
+        return DocumentHasTerm(term.id, document_id);
+     });
+    
+    // Plus terms are distinct, so the matched words are too.
+    std::vector<std::string_view> tuple_pl_words(std::distance(matched_terms.begin(), it));
+    std::transform(std::execution::par, matched_terms.begin(), it, tuple_pl_words.begin(), [this](const QueryTerm& term){return dictionary_.GetTerm(term.id);});
+    std::sort(std::execution::par, tuple_pl_words.begin(), tuple_pl_words.end());
+    return std::make_tuple(tuple_pl_words,SearchServer::id_to_all_parameters_.at(document_id).status);
+}
+
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view text, bool flag) const {
-  SearchServer::Query q;
-  for (const std::string_view& word : SearchServer::SplitIntoWordsNoStop(text)) {
+SearchServer::CompiledQuery SearchServer::CompileQuery(std::string_view raw_query) const {
+    const QueryWords words = ParseQueryWords(raw_query);
+    CompiledQuery query;
+    for (std::string_view word : words.plus_words) {
+        if (!query.text_.empty()) {
+            query.text_ += ' ';
+        }
+        query.text_ += word;
+    }
+    for (std::string_view word : words.minus_words) {
+        if (!query.text_.empty()) {
+            query.text_ += ' ';
+        }
+        query.text_ += '-';
+        query.text_ += word;
+    }
+    query.hash_ = std::hash<std::string>{}(query.text_);
+    query.server_id_ = server_id_;
+    query.index_version_ = index_version_;
+    const auto keep = [this](std::string_view word) {
+        const bool prefix = word.size() > 1 && word.back() == '*';
+        return CompiledWord{std::string{word}, prefix ? std::nullopt : dictionary_.Find(word)};
+    };
+    std::transform(words.plus_words.begin(), words.plus_words.end(), std::back_inserter(query.plus_words_), keep);
+    std::transform(words.minus_words.begin(), words.minus_words.end(), std::back_inserter(query.minus_words_), keep);
+    query.query_ = RefreshQuery(query);
+    return query;
+}
+
+bool SearchServer::IsCurrent(const CompiledQuery& query) const {
+    return query.server_id_ == server_id_ && query.index_version_ == index_version_;
+}
+
+const std::string& SearchServer::CompiledQuery::GetText() const {
+    return text_;
+}
+
+size_t SearchServer::CompiledQuery::GetHash() const {
+    return hash_;
+}
+
+bool SearchServer::CompiledQuery::operator==(const CompiledQuery& other) const {
+    return hash_ == other.hash_ && text_ == other.text_;
+}
+
+bool SearchServer::CompiledQuery::operator!=(const CompiledQuery& other) const {
+    return !(*this == other);
+}
+
+SearchServer::Query SearchServer::ParseQuery(std::string_view text) const {
+    return ResolveQuery(ParseQueryWords(text));
+}
+
+SearchServer::QueryWords SearchServer::ParseQueryWords(std::string_view text) const {
+    QueryWords words;
+    for (const std::string_view& word : SearchServer::SplitIntoWordsNoStop(text)) {
         if (!ChekDoubleMinus(word)) {
             throw std::invalid_argument("Query include word with (--) or have no word after (-) ");
         }
         if (!IsValidWord(word)) {
             throw std::invalid_argument("Incorrect symbols in document");
         }
-      (word[0] == '-') ? (q.minus_words_.push_back(word.substr(1))) : (q.plus_words_.push_back(word));
+        if (word[0] == '-') {
+            words.minus_words.push_back(word.substr(1));
+        } else {
+            words.plus_words.push_back(word);
+        }
     }
-    
-     if (flag) {
-        std::sort(std::execution::seq, q.plus_words_.begin(), q.plus_words_.end());
-        auto it = unique(std::execution::seq, q.plus_words_.begin(), q.plus_words_.end());
-        q.plus_words_.erase(it, q.plus_words_.end());
+    for (auto* list : {&words.plus_words, &words.minus_words}) {
+        std::sort(list->begin(), list->end());
+        list->erase(std::unique(list->begin(), list->end()), list->end());
     }
-    
+    return words;
+}
+
+// Words are resolved in sorted order, so the fuzzy expansion budget does not
+// depend on the order of words in the raw query.
+SearchServer::Query SearchServer::ResolveQuery(const QueryWords& words) const {
+    SearchServer::Query q;
+    int expansion_budget = fuzzy_options_.max_expansions_per_query;
+    for (std::string_view word : words.minus_words) {
+        AddMinusWord(word, std::nullopt, q.minus_terms_);
+    }
+    for (std::string_view word : words.plus_words) {
+        AddPlusWord(word, std::nullopt, q.plus_terms_, expansion_budget);
+    }
+    FinishQuery(q);
     return q;
 }
 
+// Kept term ids are only meaningful on the server that compiled the query.
+SearchServer::Query SearchServer::RefreshQuery(const CompiledQuery& query) const {
+    const bool own_terms = query.server_id_ == server_id_;
+    SearchServer::Query q;
+    int expansion_budget = fuzzy_options_.max_expansions_per_query;
+    for (const CompiledWord& word : query.minus_words_) {
+        AddMinusWord(word.text, own_terms ? word.term : std::nullopt, q.minus_terms_);
+    }
+    for (const CompiledWord& word : query.plus_words_) {
+        AddPlusWord(word.text, own_terms ? word.term : std::nullopt, q.plus_terms_, expansion_budget);
+    }
+    FinishQuery(q);
+    return q;
+}
+
+void SearchServer::AddMinusWord(std::string_view word, std::optional<TermId> term, std::vector<TermId>& terms) const {
+    if (term) {
+        terms.push_back(*term);
+    } else {
+        AddQueryTerms(word, terms);
+    }
+}
+
+void SearchServer::AddPlusWord(std::string_view word, std::optional<TermId> term, std::vector<QueryTerm>& terms, int& expansion_budget) const {
+    if (fuzzy_options_.max_distance > 0 && word.back() != '*') {
+        AddFuzzyTerms(word, terms, expansion_budget);
+    } else if (word.size() > 1 && word.back() == '*') {
+        std::vector<TermId> expansions;
+        AddQueryTerms(word, expansions);
+        for (TermId expansion : expansions) {
+            terms.push_back({expansion, 1.0});
+        }
+    } else if (const auto exact = term ? term : dictionary_.Find(word)) {
+        terms.push_back({*exact, 1.0});
+    }
+}
+
+void SearchServer::FinishQuery(Query& q) const {
+    // Prefix words can expand to the same terms.
+    std::sort(q.minus_terms_.begin(), q.minus_terms_.end());
+    q.minus_terms_.erase(std::unique(q.minus_terms_.begin(), q.minus_terms_.end()), q.minus_terms_.end());
+
+    // The same term can come from several words; keep its highest weight.
+    std::sort(std::execution::seq, q.plus_terms_.begin(), q.plus_terms_.end(), [](const QueryTerm& lhs, const QueryTerm& rhs) {
+        return lhs.id < rhs.id || (lhs.id == rhs.id && lhs.weight > rhs.weight);
+    });
+    auto it = unique(std::execution::seq, q.plus_terms_.begin(), q.plus_terms_.end(), [](const QueryTerm& lhs, const QueryTerm& rhs) {
+        return lhs.id == rhs.id;
+    });
+    q.plus_terms_.erase(it, q.plus_terms_.end());
+    for (QueryTerm& term : q.plus_terms_) {
+        if (!GetPostings(term.id).empty()) {
+            term.idf_weight = GetWordIDF(term.id) * term.weight;
+        }
+    }
+}
+
+// A trailing '*' makes the word a prefix query; it expands to at most
+// MAX_PREFIX_EXPANSION dictionary terms that still occur in some document.
+void SearchServer::AddQueryTerms(std::string_view word, std::vector<TermId>& terms) const {
+    if (word.size() > 1 && word.back() == '*') {
+        int expanded = 0;
+        dictionary_.ForEachWithPrefix(word.substr(0, word.size() - 1), [this, &terms, &expanded](TermId term, std::string_view) {
+            if (!GetPostings(term).empty()) {
+                terms.push_back(term);
+                ++expanded;
+            }
+            return expanded < MAX_PREFIX_EXPANSION;
+        });
+        return;
+    }
+    if (const auto term = dictionary_.Find(word)) {
+        terms.push_back(*term);
+    }
+}
+
 
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query)  const {
-    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
+    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, StatusIs{DocumentStatus::ACTUAL});
 }
 
 
  std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, status);
+    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, StatusIs{status});
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const CompiledQuery& query) const {
+    return SearchServer::FindTopDocuments(std::execution::seq, query, StatusIs{DocumentStatus::ACTUAL});
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const CompiledQuery& query, DocumentStatus status) const {
+    return SearchServer::FindTopDocuments(std::execution::seq, query, StatusIs{status});
 }
 
 
@@ -204,7 +902,7 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query)
 std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(const std::string_view& text) const {
     std::vector<std::string_view> words;
     for (const std::string_view& word : SplitIntoWords(text)) {
-        if (stop_words_.count(word) == 0) {
+        if (!stop_words_.Find(word)) {
             words.push_back(word);
         }
     }
@@ -212,8 +910,53 @@ std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(const std::stri
 }
 
 
-double SearchServer::GetWordIDF (std::string_view word) const {
-    return log(static_cast<double> (document_count_) / word_to_document_freqs_.at(word).size());
+// The exact term is always kept; misspelling candidates are taken closest
+// first, then by document frequency, within the per-word and per-query limits.
+void SearchServer::AddFuzzyTerms(std::string_view word, std::vector<QueryTerm>& terms, int& expansion_budget) const {
+    const int max_distance = std::min(fuzzy_options_.max_distance, static_cast<int>(word.size() / 3));
+    std::vector<std::pair<TermId, int>> matches = dictionary_.FindWithinDistance(word, max_distance);
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [this](const auto& match) {
+        return GetPostings(match.first).empty();
+    }), matches.end());
+    std::sort(matches.begin(), matches.end(), [this](const auto& lhs, const auto& rhs) {
+        if (lhs.second != rhs.second) {
+            return lhs.second < rhs.second;
+        }
+        return GetPostings(lhs.first).size() > GetPostings(rhs.first).size();
+    });
+
+    int expanded = 0;
+    for (const auto& [term, distance] : matches) {
+        if (distance > 0) {
+            if (expanded >= fuzzy_options_.max_expansions_per_word || expansion_budget <= 0) {
+                break;
+            }
+            ++expanded;
+            --expansion_budget;
+        }
+        terms.push_back({term, std::pow(fuzzy_options_.distance_penalty, distance)});
+    }
+}
+
+bool SearchServer::DocumentHasTerm(TermId term, int document_id) const {
+    const TermFrequencyRange entries = forward_index_.Get(document_id);
+    return std::binary_search(entries.begin(), entries.end(), TermFrequency{term, 0.0}, [](const TermFrequency& lhs, const TermFrequency& rhs) {
+        return lhs.term < rhs.term;
+    });
+}
+
+uint64_t SearchServer::NextServerId() {
+    static std::atomic<uint64_t> next_id{1};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+const std::pmr::map<int, double>& SearchServer::GetPostings(TermId term) const {
+    static const std::pmr::map<int, double> no_postings;
+    return term < term_to_document_freqs_.size() ? term_to_document_freqs_[term] : no_postings;
+}
+
+double SearchServer::GetWordIDF (TermId term) const {
+    return log(static_cast<double> (document_count_) / GetPostings(term).size());
 }
 
 bool SearchServer::IsValidWord(std::string_view word) const {
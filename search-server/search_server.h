@@ -3,10 +3,24 @@
 #include "string_processing.h"
 #include "concurrent_map.h"
 #include "document.h"
+#include "document_predicates.h"
+#include "term_dictionary.h"
+#include "forward_index.h"
+#include "near_duplicates.h"
+#include "counting_resource.h"
+#include "cancellation_token.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <tuple>
 #include <set>
 #include <map>
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <stdexcept>
 #include <algorithm>
 #include <execution>
@@ -19,26 +33,114 @@
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
+// Upper bound on dictionary terms a single "prefix*" query word expands to.
+const int MAX_PREFIX_EXPANSION = 64;
+
+// Typo tolerance for plus-words, disabled while max_distance is 0. A word of
+// length L is matched within min(max_distance, L / 3) edits; every edit
+// multiplies the term's contribution by distance_penalty.
+struct FuzzyOptions
+{
+    int max_distance = 0;
+    int max_expansions_per_word = 8;
+    int max_expansions_per_query = 32;
+    double distance_penalty = 0.5;
+};
+
+// What AddDocument does with a document whose Jaccard similarity (over distinct
+// words) to an indexed document reaches min_similarity. Candidates come from an
+// LSH index, so a pair at the threshold is caught with high probability, not
+// certainty; every reported pair is verified exactly.
+enum class DuplicatePolicy
+{
+    KEEP,      // index it anyway
+    REJECT,    // throw std::invalid_argument
+    REPLACE    // index it and remove the earlier near-duplicates
+};
+
+struct DuplicateOptions
+{
+    double min_similarity = 0.8;
+    DuplicatePolicy policy = DuplicatePolicy::KEEP;
+};
+
+// Postings accumulated between two checks of an asynchronous query's deadline and cancellation token.
+const size_t POSTING_BLOCK_SIZE = 256;
+
+// Result of an asynchronous query. complete is false when the deadline passed or
+// the query was cancelled: documents then holds the best top-K over the
+// postings read so far. Minus-words are always applied in full.
+struct SearchResult
+{
+    std::vector<Document> documents;
+    bool complete = true;
+};
+
+// Bytes currently allocated by each index structure.
+struct MemoryUsage
+{
+    size_t documents = 0;        // document parameters and the id set
+    size_t inverted_index = 0;   // term -> (document, tf) postings
+    size_t forward_index = 0;    // document -> (term, tf) entries
+    size_t dictionary = 0;
+    size_t stop_words = 0;
+    size_t near_duplicates = 0;  // LSH signatures
+
+    size_t Total() const;
+};
+
 class SearchServer {
 
 public:
 
+    // All index structures allocate from `resource` (through per-structure
+    // counters), so callers can back the index with pool, monotonic or
+    // NUMA-local memory resources. Parallel removal frees memory from several
+    // threads at once, so it only runs in parallel when `resource` is
+    // new_delete_resource() or a synchronized_pool_resource; with any other
+    // resource it falls back to the sequential path.
     template <typename ContainerCollection>
-    explicit SearchServer(const ContainerCollection& stop_words);
+    explicit SearchServer(const ContainerCollection& stop_words, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
-    explicit SearchServer(const std::string& stop_words);
+    explicit SearchServer(const std::string& stop_words, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     
-    explicit SearchServer(const std::string_view& stop_words);
+    explicit SearchServer(const std::string_view& stop_words, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    // Move-only: a copy would have to pick a resource for its containers.
+    // Moving hands the index over together with the resources it lives in and
+    // leaves the source an empty, usable index (no stop words) on fresh
+    // resources over the same upstream. Neither may run while asynchronous
+    // queries are pending on either server.
+    SearchServer(SearchServer&& other);
+    SearchServer& operator=(SearchServer&& other);
+
+    class CompiledQuery;
 
     int GetDocumentCount() const;
 
-    std::map<int,std::set<std::string_view>>& GetIdToWords();
+     const std::pmr::set<int>::iterator begin();
+
+     const std::pmr::set<int>::iterator end();
+
+    std::pmr::set<int>::const_iterator begin() const;
 
-     const std::set<int>::iterator begin();
+    std::pmr::set<int>::const_iterator end() const;
 
-     const std::set<int>::iterator end();
+    // Words of the document with their term frequencies, ordered by term id.
+    // Throws std::out_of_range for unknown ids; invalidated by any index mutation.
+    WordFrequenciesView GetWordFrequencies(int document_id) const;
 
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    MemoryUsage GetMemoryUsage() const;
+
+    // Once the index uses `bytes` or more, adding a document first compacts the
+    // index and then throws std::length_error if it is still over budget. 0 disables the limit.
+    void SetMemoryBudget(size_t bytes);
+
+    size_t GetMemoryBudget() const;
+
+    // Folds the dictionary overlay into its sorted array, reclaims entries of removed
+    // documents in the forward index and releases spare capacity.
+    void Compact();
 
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
@@ -51,6 +153,40 @@ public:
 
     void AddDocument(int document_id, const std::string_view& document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Bulk insertion: the parallel overload tokenizes all texts concurrently and then indexes them in order.
+    void AddDocuments(const std::execution::sequenced_policy&, const std::vector<DocumentData>& documents);
+    void AddDocuments(const std::execution::parallel_policy&, const std::vector<DocumentData>& documents);
+
+    // Re-inserts a document from already computed term frequencies (used when loading a checkpoint).
+    void RestoreDocument(int document_id, DocumentStatus status, int rating, const std::map<std::string_view, double>& word_freqs);
+
+    Document GetDocument(int document_id) const;
+
+    void SetFuzzyOptions(const FuzzyOptions& options);
+
+    void SetDuplicateOptions(const DuplicateOptions& options);
+
+    const DuplicateOptions& GetDuplicateOptions() const;
+
+    // Ids of the other documents at least min_similarity similar to document_id, sorted.
+    // Throws std::out_of_range for unknown ids.
+    std::vector<int> FindNearDuplicates(int document_id) const;
+
+    // Ids of the documents at least min_similarity similar to a document with
+    // this text: the ones DuplicatePolicy::REPLACE removes when it is added.
+    std::vector<int> FindNearDuplicates(std::string_view document) const;
+
+    // Connected components (sorted, two or more ids) of the near-duplicate
+    // relation, ordered by their first id. The parallel overload looks up the
+    // neighbours of all documents concurrently.
+    std::vector<std::vector<int>> FindNearDuplicateGroups(const std::execution::sequenced_policy&) const;
+    std::vector<std::vector<int>> FindNearDuplicateGroups(const std::execution::parallel_policy&) const;
+
+    // Walks documents in id order, keeping each one that is not a near-duplicate
+    // of an already kept document. Returns the removed ids.
+    std::vector<int> RemoveNearDuplicates(const std::execution::sequenced_policy&);
+    std::vector<int> RemoveNearDuplicates(const std::execution::parallel_policy&);
+
     int ComputeAverageRating(const std::vector<int>& ratings);
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view& raw_query, int document_id) const;
@@ -59,10 +195,20 @@ public:
     
      std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&, const std::string_view& raw_query, int document_id) const;
 
+    // Parses and resolves a query once; the result can be passed to every
+    // FindTopDocuments and MatchDocument overload instead of the raw text.
+    CompiledQuery CompileQuery(std::string_view raw_query) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const CompiledQuery& query, int document_id) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy&, const CompiledQuery& query, int document_id) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&, const CompiledQuery& query, int document_id) const;
+
 std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
 
 template <typename DocumentPredicate>
-std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate predicate) const;
+std::vector<Document> FindTopDocuments(std::string_view raw_query, const DocumentPredicate& predicate) const;
 
 std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
 
@@ -70,61 +216,313 @@ template <typename Policy>
 std::vector<Document> FindTopDocuments(const Policy& policy, std::string_view raw_query) const ;
 
 template <typename Policy, typename DocumentPredicate>
-std::vector<Document> FindTopDocuments(const Policy& policy, std::string_view raw_query, DocumentPredicate predicate) const;
+std::vector<Document> FindTopDocuments(const Policy& policy, std::string_view raw_query, const DocumentPredicate& predicate) const;
 
 template <typename Policy>    
 std::vector<Document> FindTopDocuments(const Policy& policy, std::string_view raw_query, DocumentStatus status) const;
+
+std::vector<Document> FindTopDocuments(const CompiledQuery& query) const;
+
+template <typename DocumentPredicate>
+std::vector<Document> FindTopDocuments(const CompiledQuery& query, const DocumentPredicate& predicate) const;
+
+std::vector<Document> FindTopDocuments(const CompiledQuery& query, DocumentStatus status) const;
+
+template <typename Policy>
+std::vector<Document> FindTopDocuments(const Policy& policy, const CompiledQuery& query) const;
+
+template <typename Policy, typename DocumentPredicate>
+std::vector<Document> FindTopDocuments(const Policy& policy, const CompiledQuery& query, const DocumentPredicate& predicate) const;
+
+template <typename Policy>
+std::vector<Document> FindTopDocuments(const Policy& policy, const CompiledQuery& query, DocumentStatus status) const;
+
+// Runs the query on its own std::async thread, which reads the index without
+// locking: the server must outlive the returned future and must not be
+// mutated (documents, options, Compact) until the future is ready. There is
+// no queue: when max_pending_queries threads are already running the query is
+// rejected at once and the future holds std::runtime_error instead of a result.
+template <typename DocumentPredicate>
+std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentPredicate predicate) const;
+
+std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, std::chrono::steady_clock::time_point deadline, CancellationToken token = CancellationToken{}, DocumentStatus status = DocumentStatus::ACTUAL) const;
+
+template <typename DocumentPredicate>
+std::future<SearchResult> FindTopDocumentsAsync(CompiledQuery query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentPredicate predicate) const;
+
+std::future<SearchResult> FindTopDocumentsAsync(CompiledQuery query, std::chrono::steady_clock::time_point deadline, CancellationToken token = CancellationToken{}, DocumentStatus status = DocumentStatus::ACTUAL) const;
+
+// Caps the number of asynchronous query threads running at once.
+void SetMaxPendingQueries(size_t count);
+
+// Evaluates a batch with the same results as FindTopDocuments(query) for each
+// query. Queries are grouped by term, each posting list is read once for the
+// whole batch, and its contributions are scattered to every query using it.
+std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const;
+
+std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<CompiledQuery>& queries) const;
     
 
     private:
 
 
+    struct QueryTerm
+    {
+        TermId id = 0;
+        double weight = 1.0;       // fuzzy distance penalty
+        double idf_weight = 0.0;   // GetWordIDF(id) * weight
+    };
+
+    // Query words resolved to term ids; words missing from the dictionary are dropped.
+    // Both term lists are sorted by id and free of duplicates.
     struct Query
     {
-        std::vector<std::string_view> minus_words_;
-        std::vector<std::string_view> plus_words_;
+        std::vector<TermId> minus_terms_;
+        std::vector<QueryTerm> plus_terms_;
     };
 
-    Query ParseQuery(std::string_view text, bool flag) const;
+    // Validated query words without stop words, each list sorted and deduplicated.
+    // Minus-words are stored without the leading '-'.
+    struct QueryWords
+    {
+        std::vector<std::string_view> plus_words;
+        std::vector<std::string_view> minus_words;
+    };
+
+    // A normalized word kept by CompiledQuery, with the term id of an exact word
+    // that was in the dictionary when the query was compiled.
+    struct CompiledWord
+    {
+        std::string text;
+        std::optional<TermId> term;
+    };
+
+    Query ParseQuery(std::string_view text) const;
+
+    QueryWords ParseQueryWords(std::string_view text) const;
+
+    Query ResolveQuery(const QueryWords& words) const;
+
+    // Resolves the kept words of a compiled query against the current index.
+    Query RefreshQuery(const CompiledQuery& query) const;
+
+    // A known term skips the dictionary lookup of an exact word.
+    void AddMinusWord(std::string_view word, std::optional<TermId> term, std::vector<TermId>& terms) const;
+
+    void AddPlusWord(std::string_view word, std::optional<TermId> term, std::vector<QueryTerm>& terms, int& expansion_budget) const;
+
+    // Sorts and deduplicates the terms and computes the IDF weights.
+    void FinishQuery(Query& query) const;
+
+    bool IsCurrent(const CompiledQuery& query) const;
+
+    // Calls run(terms) with the query's own terms, or with terms refreshed from
+    // its kept words when the index changed after it was compiled.
+    template <typename Run>
+    auto WithCurrentQuery(const CompiledQuery& query, Run run) const;
+
+    template <typename DocumentPredicate, typename MakeQuery>
+    std::future<SearchResult> RunAsync(MakeQuery make_query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentPredicate predicate) const;
+
+    std::vector<std::vector<Document>> EvaluateBatch(const std::vector<const Query*>& queries) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchQuery(const std::execution::sequenced_policy&, const Query& query, int document_id) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchQuery(const std::execution::parallel_policy&, const Query& query, int document_id) const;
+
+    void AddQueryTerms(std::string_view word, std::vector<TermId>& terms) const;
+
+    void AddFuzzyTerms(std::string_view word, std::vector<QueryTerm>& terms, int& expansion_budget) const;
+
+
 
+    struct MemoryResources
+    {
+        explicit MemoryResources(std::pmr::memory_resource* upstream);
+
+        CountingResource documents;
+        CountingResource inverted_index;
+        CountingResource forward_index;
+        CountingResource dictionary;
+        CountingResource stop_words;
+        CountingResource near_duplicates;
+        std::pmr::memory_resource* upstream;
+        // Whether the upstream may be called from several threads at once.
+        bool thread_safe;
+    };
 
+    // Declared first: the containers below allocate from it. Held by pointer so
+    // the containers' allocators stay valid when the server is moved.
+    std::unique_ptr<MemoryResources> memory_;
 
-    std::map <int, Document> id_to_all_parameters_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::set <std::string, std::less<>> stop_words_;
-    std::set<int> all_docs_ids_;
-    std::map<int, std::map<std::string_view, double>> word_freq_;
-    std::map<int,std::set<std::string_view>> id_doc_words_;
-    std::map<int, std::list<std::string>> all_document_words_;
+    std::pmr::map <int, Document> id_to_all_parameters_;
+    std::pmr::vector<std::pmr::map<int, double>> term_to_document_freqs_;
+    TermDictionary stop_words_;
+    std::pmr::set<int> all_docs_ids_;
+    ForwardIndex forward_index_;
+    // Owns the text of every indexed word, so term ids and the string_views
+    // handed out stay valid when the document that introduced a word is removed.
+    TermDictionary dictionary_;
+    NearDuplicateIndex near_duplicates_;
 
 
     int document_count_ = 0;
+
+    FuzzyOptions fuzzy_options_;
+
+    // Unique per server in the process (0 is never used), so a compiled query can
+    // tell which server its term ids belong to; an address could be reused.
+    uint64_t server_id_;
+
+    // Bumped by every change that can alter how a query resolves or is weighted.
+    uint64_t index_version_ = 0;
+
+    DuplicateOptions duplicate_options_;
+
+    size_t memory_budget_ = 0;
     
+    // Never fires; synchronous queries use it so the checks compile away.
+    struct NoInterrupt
+    {
+        constexpr bool operator()() const { return false; }
+    };
+
+    // Fires once the deadline has passed or the token is cancelled, and stays fired.
+    class QueryInterrupt {
+    public:
+        QueryInterrupt(CancellationToken token, std::chrono::steady_clock::time_point deadline);
+        bool operator()() const;
+        bool IsTriggered() const;
+    private:
+        CancellationToken token_;
+        std::chrono::steady_clock::time_point deadline_;
+        mutable std::atomic<bool> triggered_{false};
+    };
+
+    std::unique_ptr<std::atomic<size_t>> pending_queries_ = std::make_unique<std::atomic<size_t>>(0);
+    size_t max_pending_queries_ = 64;
+
+template <typename Policy, typename Interrupt = NoInterrupt>
+std::map<int, double> CheckPlusMinusWords (const Policy& policy, const Query& query_words, const Interrupt& interrupted = {}) const; 
+
+template <typename Policy, typename Predicate, typename Interrupt = NoInterrupt>
+std::vector<Document> FindAllDocuments(const Policy& policy, const Query& query_words, const Predicate& predicate, const Interrupt& interrupted = {}) const;  
+
 template <typename Policy>
-std::map<int, double> CheckPlusMinusWords (const Policy& policy, const Query query_words) const; 
+void SortAndTruncate(const Policy& policy, std::vector<Document>& documents) const;
 
-template <typename Policy, typename Predicate>
-std::vector<Document> FindAllDocuments(const Policy& policy, const Query query_words, Predicate predicate) const;  
+template <typename Relevance, typename Predicate>
+std::vector<Document> SelectDocuments(const Relevance& document_to_relevance, const Predicate& predicate) const;
     
     std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view& text) const;
 
-    double GetWordIDF (std::string_view word) const ;
+    void CheckNewDocumentId(int document_id) const;
+
+    std::map<std::string_view, double> ComputeWordFrequencies(const std::vector<std::string_view>& words) const;
+
+    void IndexDocument(int document_id, DocumentStatus status, int rating, const std::map<std::string_view, double>& word_freqs, const LshKeys& keys);
+
+    // Applies duplicate_options_ to a document about to be indexed: throws for
+    // REJECT, returns the documents to remove after indexing it for REPLACE.
+    std::vector<int> CheckNearDuplicates(const std::map<std::string_view, double>& word_freqs, const LshKeys& keys) const;
+
+    // Verified near-duplicates among the LSH candidates of keys, except exclude_id.
+    std::vector<int> FindNearDuplicates(const LshKeys& keys, TermFrequencyRange entries, int exclude_id) const;
+
+    // Near-duplicates of a document that is not indexed yet.
+    std::vector<int> FindNearDuplicates(const std::map<std::string_view, double>& word_freqs, const LshKeys& keys) const;
+
+    // For each document of ids, its near-duplicates with a greater id.
+    template <typename Policy>
+    std::vector<std::vector<int>> FindNearDuplicatePairs(const Policy& policy, const std::vector<int>& ids) const;
+
+    void CheckMemoryBudget();
+
+    bool DocumentHasTerm(TermId term, int document_id) const;
+
+    double GetWordIDF (TermId term) const ;
+
+    static uint64_t NextServerId();
+
+    // Takes other's index and resources, and gives other an empty index in their place.
+    void TakeIndex(SearchServer& other);
+
+    // Re-creates the index empty, on fresh resources over upstream.
+    void ResetIndex(std::pmr::memory_resource* upstream);
+
+    // Postings of term; empty for ids this server never assigned.
+    const std::pmr::map<int, double>& GetPostings(TermId term) const;
+
+};
+
+// A query parsed once and resolved against a server: stop words dropped,
+// plus- and minus-words deduplicated and sorted, words resolved to term ids
+// and IDF weights precomputed. It owns all its data, so it can be cached,
+// queued or moved to another thread after the raw text is gone. Running it
+// after the index changed does not parse the text again: exact words keep
+// their term ids (the dictionary only grows), and only prefix and fuzzy
+// expansions, words unknown at compile time and IDF weights are redone.
+class SearchServer::CompiledQuery {
+
+public:
+
+    CompiledQuery() = default;
+
+    // "plus words -minus words", each group sorted.
+    const std::string& GetText() const;
+
+    size_t GetHash() const;
+
+    // Queries with the same normalized text are equal and always match the same documents.
+    bool operator==(const CompiledQuery& other) const;
+    bool operator!=(const CompiledQuery& other) const;
+
+private:
+    friend class SearchServer;
+
+    std::string text_;
+    size_t hash_ = std::hash<std::string>{}(std::string{});
+    uint64_t server_id_ = 0;
+    uint64_t index_version_ = 0;
+    std::vector<CompiledWord> plus_words_;
+    std::vector<CompiledWord> minus_words_;
+    Query query_;
+};
 
+namespace std {
+template <>
+struct hash<SearchServer::CompiledQuery>
+{
+    size_t operator()(const SearchServer::CompiledQuery& query) const {
+        return query.GetHash();
+    }
 };
+}  // namespace std
 
 
 template <typename ContainerCollection>
-SearchServer::SearchServer(const ContainerCollection& stop_words){
+SearchServer::SearchServer(const ContainerCollection& stop_words, std::pmr::memory_resource* resource)
+    : memory_(std::make_unique<MemoryResources>(resource))
+    , id_to_all_parameters_(&memory_->documents)
+    , term_to_document_freqs_(&memory_->inverted_index)
+    , stop_words_(&memory_->stop_words)
+    , all_docs_ids_(&memory_->documents)
+    , forward_index_(&memory_->forward_index)
+    , dictionary_(&memory_->dictionary)
+    , near_duplicates_(&memory_->near_duplicates)
+    , server_id_(NextServerId())
+{
         for (const auto& word : stop_words)
         {
             if(!word.empty() && IsValidWord(word)) {
-                stop_words_.insert(std::string{word});
+                stop_words_.Add(word);
             } else throw std::invalid_argument("Incorrect symbols at stop word : " + std::string{word});
         }
+        stop_words_.Compact();
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate predicate) const {
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, const DocumentPredicate& predicate) const {
    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, predicate);
 }
 
@@ -135,18 +533,97 @@ std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, std::
 
 template <typename Policy>    
 std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, std::string_view raw_query, DocumentStatus status) const {
-     const auto predicate = [status](int document_id, DocumentStatus stat, int rating)
-    {
-        return stat == status;
-    };
-    return SearchServer::FindTopDocuments(policy, raw_query, predicate);
+    return SearchServer::FindTopDocuments(policy, raw_query, StatusIs{status});
 }
 
 
 template <typename Policy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, std::string_view raw_query, DocumentPredicate predicate) const {
-    const SearchServer::Query query_words = ParseQuery(raw_query, true);
+std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, std::string_view raw_query, const DocumentPredicate& predicate) const {
+    const SearchServer::Query query_words = ParseQuery(raw_query);
     auto result = SearchServer::FindAllDocuments(policy, query_words, predicate);
+    SortAndTruncate(policy, result);
+    return result;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const CompiledQuery& query, const DocumentPredicate& predicate) const {
+    return SearchServer::FindTopDocuments(std::execution::seq, query, predicate);
+}
+
+template <typename Policy>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, const CompiledQuery& query) const {
+    return SearchServer::FindTopDocuments(policy, query, DocumentStatus::ACTUAL);
+}
+
+template <typename Policy>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, const CompiledQuery& query, DocumentStatus status) const {
+    return SearchServer::FindTopDocuments(policy, query, StatusIs{status});
+}
+
+template <typename Policy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, const CompiledQuery& query, const DocumentPredicate& predicate) const {
+    return WithCurrentQuery(query, [this, &policy, &predicate](const Query& query_words) {
+        auto result = SearchServer::FindAllDocuments(policy, query_words, predicate);
+        SortAndTruncate(policy, result);
+        return result;
+    });
+}
+
+template <typename Run>
+auto SearchServer::WithCurrentQuery(const CompiledQuery& query, Run run) const {
+    if (IsCurrent(query)) {
+        return run(query.query_);
+    }
+    return run(RefreshQuery(query));
+}
+
+template <typename DocumentPredicate>
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentPredicate predicate) const {
+    return RunAsync([this, raw_query = std::move(raw_query)](const auto& run) {
+        return run(ParseQuery(raw_query));
+    }, deadline, std::move(token), std::move(predicate));
+}
+
+template <typename DocumentPredicate>
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(CompiledQuery query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentPredicate predicate) const {
+    return RunAsync([this, query = std::move(query)](const auto& run) {
+        return WithCurrentQuery(query, run);
+    }, deadline, std::move(token), std::move(predicate));
+}
+
+// make_query(run) calls run with the query terms; it is invoked on the query's thread.
+template <typename DocumentPredicate, typename MakeQuery>
+std::future<SearchResult> SearchServer::RunAsync(MakeQuery make_query, std::chrono::steady_clock::time_point deadline, CancellationToken token, DocumentPredicate predicate) const {
+    if (pending_queries_->fetch_add(1) >= max_pending_queries_) {
+        pending_queries_->fetch_sub(1);
+        std::promise<SearchResult> rejected;
+        rejected.set_exception(std::make_exception_ptr(std::runtime_error("Too many pending queries, request rejected")));
+        return rejected.get_future();
+    }
+    try {
+        return std::async(std::launch::async, [this, make_query = std::move(make_query), deadline, token = std::move(token), predicate = std::move(predicate)] {
+            struct PendingGuard {
+                std::atomic<size_t>& counter;
+                ~PendingGuard() { counter.fetch_sub(1); }
+            } guard{*pending_queries_};
+
+            const QueryInterrupt interrupted(token, deadline);
+            SearchResult result;
+            result.documents = make_query([this, &predicate, &interrupted](const Query& query_words) {
+                return FindAllDocuments(std::execution::seq, query_words, predicate, interrupted);
+            });
+            SortAndTruncate(std::execution::seq, result.documents);
+            result.complete = !interrupted.IsTriggered();
+            return result;
+        });
+    } catch (...) {
+        pending_queries_->fetch_sub(1);
+        throw;
+    }
+}
+
+template <typename Policy>
+void SearchServer::SortAndTruncate(const Policy& policy, std::vector<Document>& result) const {
     const double EPSILON = 1e-6;
     std::sort(policy, result.begin(), result.end(),[&EPSILON](const Document& lhs, const Document& rhs) {
         if (std::abs(lhs.relevance - rhs.relevance)< EPSILON) {
@@ -157,61 +634,59 @@ std::vector<Document> SearchServer::FindTopDocuments(const Policy& policy, std::
         if (result.size() > MAX_RESULT_DOCUMENT_COUNT) {
             result.resize(MAX_RESULT_DOCUMENT_COUNT);
         }
-        return result;
 }
 
-template <typename Policy, typename Predicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Policy& policy, const Query query_words, Predicate predicate) const
+template <typename Policy, typename Predicate, typename Interrupt>
+std::vector<Document> SearchServer::FindAllDocuments(const Policy& policy, const Query& query_words, const Predicate& predicate, const Interrupt& interrupted) const
+{
+    return SelectDocuments(CheckPlusMinusWords(policy, query_words, interrupted), predicate);
+}
+
+template <typename Relevance, typename Predicate>
+std::vector<Document> SearchServer::SelectDocuments(const Relevance& document_to_relevance, const Predicate& predicate) const
 {
-    std::map<int, double> document_to_relevance = CheckPlusMinusWords(policy, query_words);
-    std::vector<Document> matched_documents;
-    std::for_each(policy, document_to_relevance.begin(), document_to_relevance.end(), [this, &matched_documents](auto& pair) {
+    std::vector<Document> match_doc;
+    for (const auto& [id, relevance] : document_to_relevance) {
+        const Document& parameters = id_to_all_parameters_.at(id);
+        if (predicate(id, parameters.status, parameters.rating)) {
             Document q;
-            q.id = pair.first;
-            q.rating = id_to_all_parameters_.at(pair.first).rating;
-            q.status = id_to_all_parameters_.at(pair.first).status;
-            q.relevance = pair.second;
-            matched_documents.push_back(q);
-    });
-    
-    std::vector<Document>match_doc;
-    std::for_each(std::execution::seq, matched_documents.begin(), matched_documents.end(), [this, &match_doc, predicate](auto& doc){
-        if (predicate(doc.id,doc.status,doc.rating))
-        {
-           match_doc.push_back(doc);
+            q.id = id;
+            q.rating = parameters.rating;
+            q.status = parameters.status;
+            q.relevance = relevance;
+            match_doc.push_back(q);
         }
-        else return;
-    });
+    }
     return match_doc;
 }
 
 
-template <typename Policy>
-std::map<int, double> SearchServer::CheckPlusMinusWords (const Policy& policy, const Query query_words) const {
-  ConcurrentMap <int, double> document_to_relevance(std::thread::hardware_concurrency() - 1);
+// Plus-word postings are read in blocks of POSTING_BLOCK_SIZE with an interrupt
+// check before each block; once it fires the remaining postings are skipped.
+template <typename Policy, typename Interrupt>
+std::map<int, double> SearchServer::CheckPlusMinusWords (const Policy& policy, const Query& query_words, const Interrupt& interrupted) const {
+  ConcurrentMap <int, double> document_to_relevance(std::max(1u, std::thread::hardware_concurrency()));
   
-std::for_each(policy, query_words.plus_words_.begin(), query_words.plus_words_.end(), [this, &document_to_relevance] (auto word) { 
-  if (word_to_document_freqs_.count(word) == 0) {return;}
-         int count_match = SearchServer::word_to_document_freqs_.at(word).size();
-            if (count_match != 0)  {
-                double IDF_word = GetWordIDF(word);
-                const auto& ID_with_TF = word_to_document_freqs_.at(word);
+std::for_each(policy, query_words.plus_terms_.begin(), query_words.plus_terms_.end(), [this, &document_to_relevance, &interrupted] (const QueryTerm& term) { 
+         const auto& ID_with_TF = GetPostings(term.id);
+            if (!ID_with_TF.empty())  {
+                double IDF_word = term.idf_weight;
+                size_t processed = 0;
                 for (const auto& [id, tf] : ID_with_TF) {
-                    document_to_relevance[id].ref_to_value += IDF_word * ID_with_TF.at(id);
+                    if (processed++ % POSTING_BLOCK_SIZE == 0 && interrupted()) {
+                        return;
+                    }
+                    document_to_relevance[id].ref_to_value += IDF_word * tf;
                 }
             
   }});
   
     
-    std::for_each(policy, query_words.minus_words_.begin(), query_words.minus_words_.end(),[policy, this, &document_to_relevance](auto word){
-    if (SearchServer::word_to_document_freqs_.count(word) == 0) {return;}
-        int count_match = SearchServer::word_to_document_freqs_.at(word).size();
-            if (count_match != 0)  {
-        std::for_each(policy, word_to_document_freqs_.at(word).begin(), word_to_document_freqs_.at(word).end(),[&document_to_relevance, this](auto& pair){
+    std::for_each(policy, query_words.minus_terms_.begin(), query_words.minus_terms_.end(),[policy, this, &document_to_relevance](TermId term){
+        const auto& ID_with_TF = GetPostings(term);
+        std::for_each(policy, ID_with_TF.begin(), ID_with_TF.end(),[&document_to_relevance](auto& pair){
              document_to_relevance.Erase(pair.first);
         });
-            }
-        
     });
     return document_to_relevance.BuildOrdinaryMap();
 }
\ No newline at end of file
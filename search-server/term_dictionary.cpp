@@ -0,0 +1,230 @@
+#include "term_dictionary.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <string>
+
+namespace {
+
+// Smallest string greater than every string starting with prefix; empty if there is none.
+std::string PrefixSuccessor(std::string_view prefix) {
+    std::string successor{prefix};
+    while (!successor.empty() && static_cast<unsigned char>(successor.back()) == 0xFF) {
+        successor.pop_back();
+    }
+    if (!successor.empty()) {
+        ++successor.back();
+    }
+    return successor;
+}
+
+size_t CommonPrefixLength(std::string_view lhs, std::string_view rhs) {
+    const size_t limit = std::min(lhs.size(), rhs.size());
+    size_t length = 0;
+    while (length < limit && lhs[length] == rhs[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// rows[d] is the automaton state after reading the first d characters of the
+// current term; rows up to valid_depth are reused for the next term.
+template <typename It, typename GetEntry, typename Seek>
+void WalkWithinDistance(It it, It last, GetEntry get_entry, Seek seek, std::string_view query, int max_distance, std::vector<std::pair<TermId, int>>& matches) {
+    const size_t n = query.size();
+    std::vector<std::vector<int>> rows(1, std::vector<int>(n + 1));
+    std::iota(rows[0].begin(), rows[0].end(), 0);
+    std::string_view previous;
+    size_t valid_depth = 0;
+
+    while (it != last) {
+        const auto [id, term] = get_entry(it);
+        size_t depth = std::min(CommonPrefixLength(previous, term), valid_depth);
+        bool pruned = false;
+        for (; depth < term.size(); ++depth) {
+            if (rows.size() <= depth + 1) {
+                rows.emplace_back(n + 1);
+            }
+            const std::vector<int>& prev_row = rows[depth];
+            std::vector<int>& row = rows[depth + 1];
+            row[0] = static_cast<int>(depth + 1);
+            int best = row[0];
+            for (size_t j = 1; j <= n; ++j) {
+                const int substitution = prev_row[j - 1] + (query[j - 1] == term[depth] ? 0 : 1);
+                row[j] = std::min({prev_row[j] + 1, row[j - 1] + 1, substitution});
+                best = std::min(best, row[j]);
+            }
+            if (best > max_distance) {
+                pruned = true;
+                break;
+            }
+        }
+        previous = term;
+        valid_depth = depth;
+        if (pruned) {
+            const std::string successor = PrefixSuccessor(term.substr(0, depth + 1));
+            it = successor.empty() ? last : seek(successor);
+            continue;
+        }
+        if (rows[term.size()][n] <= max_distance) {
+            matches.emplace_back(id, rows[term.size()][n]);
+        }
+        ++it;
+    }
+}
+
+}  // namespace
+
+TermDictionary::TermDictionary(std::pmr::memory_resource* resource)
+    : resource_(resource)
+    , chunks_(resource)
+    , id_to_term_(resource)
+    , sorted_ids_(resource)
+    , overlay_(resource)
+{
+}
+
+TermDictionary::TermDictionary(TermDictionary&& other) noexcept
+    : resource_(other.resource_)
+    , chunks_(std::move(other.chunks_))
+    , chunk_used_(std::exchange(other.chunk_used_, 0))
+    , id_to_term_(std::move(other.id_to_term_))
+    , sorted_ids_(std::move(other.sorted_ids_))
+    , overlay_(std::move(other.overlay_))
+{
+    other.chunks_.clear();
+}
+
+TermDictionary& TermDictionary::operator=(TermDictionary&& other) {
+    if (this == &other) {
+        return *this;
+    }
+    Release();
+    if (resource_->is_equal(*other.resource_)) {
+        chunks_ = std::move(other.chunks_);
+        chunk_used_ = std::exchange(other.chunk_used_, 0);
+        id_to_term_ = std::move(other.id_to_term_);
+        sorted_ids_ = std::move(other.sorted_ids_);
+        overlay_ = std::move(other.overlay_);
+        other.chunks_.clear();
+    } else {
+        for (TermId id = 0; id < other.Size(); ++id) {
+            Add(other.GetTerm(id));
+        }
+        Compact();
+        other.Release();
+    }
+    return *this;
+}
+
+TermDictionary::~TermDictionary() {
+    Release();
+}
+
+void TermDictionary::Release() {
+    for (const Chunk& chunk : chunks_) {
+        resource_->deallocate(chunk.data, chunk.size, 1);
+    }
+    chunks_.clear();
+    chunk_used_ = 0;
+    id_to_term_.clear();
+    sorted_ids_.clear();
+    overlay_.clear();
+}
+
+TermId TermDictionary::Add(std::string_view term) {
+    if (const auto existing = Find(term)) {
+        return *existing;
+    }
+    const auto id = static_cast<TermId>(id_to_term_.size());
+    const std::string_view stored = Store(term);
+    id_to_term_.push_back(stored);
+    overlay_.emplace(stored, id);
+    if (overlay_.size() >= std::max(MIN_OVERLAY_LIMIT, sorted_ids_.size() / 8)) {
+        Compact();
+    }
+    return id;
+}
+
+std::optional<TermId> TermDictionary::Find(std::string_view term) const {
+    const auto it = LowerBound(term);
+    if (it != sorted_ids_.end() && id_to_term_[*it] == term) {
+        return *it;
+    }
+    const auto overlay_it = overlay_.find(term);
+    if (overlay_it != overlay_.end()) {
+        return overlay_it->second;
+    }
+    return std::nullopt;
+}
+
+std::string_view TermDictionary::GetTerm(TermId id) const {
+    return id_to_term_.at(id);
+}
+
+size_t TermDictionary::Size() const {
+    return id_to_term_.size();
+}
+
+void TermDictionary::Compact() {
+    if (overlay_.empty()) {
+        return;
+    }
+    std::pmr::vector<TermId> merged(resource_);
+    merged.reserve(sorted_ids_.size() + overlay_.size());
+    auto base_it = sorted_ids_.begin();
+    for (const auto& [term, id] : overlay_) {
+        while (base_it != sorted_ids_.end() && id_to_term_[*base_it] < term) {
+            merged.push_back(*base_it++);
+        }
+        merged.push_back(id);
+    }
+    merged.insert(merged.end(), base_it, sorted_ids_.end());
+    sorted_ids_ = std::move(merged);
+    overlay_.clear();
+}
+
+std::vector<std::pair<TermId, int>> TermDictionary::FindWithinDistance(std::string_view term, int max_distance) const {
+    std::vector<std::pair<TermId, int>> matches;
+    WalkWithinDistance(sorted_ids_.begin(), sorted_ids_.end(),
+        [this](std::pmr::vector<TermId>::const_iterator it) { return std::pair{*it, id_to_term_[*it]}; },
+        [this](const std::string& successor) { return LowerBound(successor); },
+        term, max_distance, matches);
+    WalkWithinDistance(overlay_.begin(), overlay_.end(),
+        [](std::pmr::map<std::string_view, TermId>::const_iterator it) { return std::pair{it->second, it->first}; },
+        [this](const std::string& successor) { return overlay_.lower_bound(successor); },
+        term, max_distance, matches);
+    return matches;
+}
+
+std::string_view TermDictionary::Store(std::string_view term) {
+    if (term.size() > CHUNK_SIZE / 4) {
+        // Long terms get a chunk of their own, placed before the one still being filled.
+        const Chunk chunk{static_cast<char*>(resource_->allocate(term.size(), 1)), term.size()};
+        std::memcpy(chunk.data, term.data(), term.size());
+        if (chunks_.empty()) {
+            chunks_.push_back(chunk);
+            chunk_used_ = chunk.size;
+        } else {
+            chunks_.insert(std::prev(chunks_.end()), chunk);
+        }
+        return {chunk.data, chunk.size};
+    }
+    if (chunks_.empty() || chunk_used_ + term.size() > chunks_.back().size) {
+        const size_t previous = chunks_.empty() ? 0 : chunks_.back().size;
+        const size_t size = std::max({MIN_CHUNK_SIZE, std::min(previous * 2, CHUNK_SIZE), term.size()});
+        chunks_.push_back({static_cast<char*>(resource_->allocate(size, 1)), size});
+        chunk_used_ = 0;
+    }
+    char* dest = chunks_.back().data + chunk_used_;
+    std::memcpy(dest, term.data(), term.size());
+    chunk_used_ += term.size();
+    return {dest, term.size()};
+}
+
+std::pmr::vector<TermId>::const_iterator TermDictionary::LowerBound(std::string_view term) const {
+    return std::lower_bound(sorted_ids_.begin(), sorted_ids_.end(), term, [this](TermId id, std::string_view value) {
+        return id_to_term_[id] < value;
+    });
+}
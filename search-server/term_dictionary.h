@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using TermId = uint32_t;
+
+// Interns terms and maps them to dense ids. Term text lives in append-only
+// chunks, so the string_views handed out stay valid for the dictionary's
+// lifetime. Lookups go through an immutable array of ids sorted by term
+// (binary search, prefix ranges) plus a small ordered overlay of recently
+// added terms that is merged into the array once it grows past a threshold.
+class TermDictionary {
+
+public:
+
+    explicit TermDictionary(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    ~TermDictionary();
+
+    TermDictionary(const TermDictionary&) = delete;
+    TermDictionary& operator=(const TermDictionary&) = delete;
+
+    TermDictionary(TermDictionary&& other) noexcept;
+    // Keeps this dictionary's resource. Chunks are handed over only when the
+    // resources are equal; otherwise the terms are re-interned, keeping their ids.
+    TermDictionary& operator=(TermDictionary&& other);
+
+    TermId Add(std::string_view term);
+
+    std::optional<TermId> Find(std::string_view term) const;
+
+    std::string_view GetTerm(TermId id) const;
+
+    size_t Size() const;
+
+    // Merges the overlay into the sorted array.
+    void Compact();
+
+    // Calls visitor(id, term) for terms starting with prefix in lexicographic
+    // order until it returns false.
+    template <typename Visitor>
+    void ForEachWithPrefix(std::string_view prefix, Visitor visitor) const;
+
+    // Returns (id, edit distance) of every term within max_distance Levenshtein
+    // edits of term. The sorted terms are walked as an implicit trie: automaton
+    // states (DP rows) are shared by terms with a common prefix, and a prefix
+    // range is skipped as soon as no continuation can get within max_distance.
+    std::vector<std::pair<TermId, int>> FindWithinDistance(std::string_view term, int max_distance) const;
+
+private:
+    // Chunks grow geometrically, so small dictionaries (stop words) stay small.
+    static constexpr size_t MIN_CHUNK_SIZE = 256;
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t MIN_OVERLAY_LIMIT = 1024;
+
+    struct Chunk
+    {
+        char* data = nullptr;
+        size_t size = 0;
+    };
+
+    std::pmr::memory_resource* resource_;
+    std::pmr::vector<Chunk> chunks_;
+    size_t chunk_used_ = 0;
+    std::pmr::vector<std::string_view> id_to_term_;
+    std::pmr::vector<TermId> sorted_ids_;
+    std::pmr::map<std::string_view, TermId> overlay_;
+
+    std::string_view Store(std::string_view term);
+    void Release();
+    std::pmr::vector<TermId>::const_iterator LowerBound(std::string_view term) const;
+};
+
+
+template <typename Visitor>
+void TermDictionary::ForEachWithPrefix(std::string_view prefix, Visitor visitor) const {
+    const auto has_prefix = [prefix](std::string_view term) {
+        return term.substr(0, prefix.size()) == prefix;
+    };
+    auto base_it = LowerBound(prefix);
+    auto overlay_it = overlay_.lower_bound(prefix);
+    while (true) {
+        const bool base_live = base_it != sorted_ids_.end() && has_prefix(id_to_term_[*base_it]);
+        const bool overlay_live = overlay_it != overlay_.end() && has_prefix(overlay_it->first);
+        if (!base_live && !overlay_live) {
+            return;
+        }
+        TermId id;
+        if (base_live && (!overlay_live || id_to_term_[*base_it] < overlay_it->first)) {
+            id = *base_it++;
+        } else {
+            id = overlay_it++->second;
+        }
+        if (!visitor(id, id_to_term_[id])) {
+            return;
+        }
+    }
+}
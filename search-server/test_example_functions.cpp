@@ -0,0 +1,789 @@
+#include "test_example_functions.h"
+#include "index_persistence.h"
+#include "search_server.h"
+#include "term_dictionary.h"
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace std::string_literals;
+
+namespace {
+
+void Check(bool condition, const std::string& message) {
+    if (!condition) {
+        throw std::logic_error("Test failed: " + message);
+    }
+}
+
+std::string MakeTestDirectory(const std::string& name) {
+    const auto directory = std::filesystem::temp_directory_path() / ("search_server_" + name);
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    return directory.string();
+}
+
+DocumentData MakeDocument(int id, std::string text, DocumentStatus status, std::vector<int> ratings) {
+    DocumentData document;
+    document.id = id;
+    document.text = std::move(text);
+    document.status = status;
+    document.ratings = std::move(ratings);
+    return document;
+}
+
+// Makes writes past max_size fail with EFBIG until destroyed.
+class FileSizeLimit {
+public:
+    explicit FileSizeLimit(uintmax_t max_size) {
+        ::getrlimit(RLIMIT_FSIZE, &saved_);
+        rlimit limit = saved_;
+        limit.rlim_cur = static_cast<rlim_t>(max_size);
+        saved_handler_ = std::signal(SIGXFSZ, SIG_IGN);
+        ::setrlimit(RLIMIT_FSIZE, &limit);
+    }
+
+    ~FileSizeLimit() {
+        ::setrlimit(RLIMIT_FSIZE, &saved_);
+        std::signal(SIGXFSZ, saved_handler_);
+    }
+
+    FileSizeLimit(const FileSizeLimit&) = delete;
+    FileSizeLimit& operator=(const FileSizeLimit&) = delete;
+
+private:
+    rlimit saved_{};
+    void (*saved_handler_)(int) = SIG_DFL;
+};
+
+int LevenshteinDistance(std::string_view lhs, std::string_view rhs) {
+    std::vector<int> row(rhs.size() + 1);
+    for (size_t j = 0; j <= rhs.size(); ++j) {
+        row[j] = static_cast<int>(j);
+    }
+    for (size_t i = 1; i <= lhs.size(); ++i) {
+        int diagonal = row[0];
+        row[0] = static_cast<int>(i);
+        for (size_t j = 1; j <= rhs.size(); ++j) {
+            const int substitution = diagonal + (lhs[i - 1] == rhs[j - 1] ? 0 : 1);
+            diagonal = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, substitution});
+        }
+    }
+    return row[rhs.size()];
+}
+
+std::string RandomWord(std::mt19937& generator, std::string_view alphabet, int max_length) {
+    std::string word(std::uniform_int_distribution<int>(1, max_length)(generator), ' ');
+    for (char& c : word) {
+        c = alphabet[std::uniform_int_distribution<size_t>(0, alphabet.size() - 1)(generator)];
+    }
+    return word;
+}
+
+bool SameRecord(const WalRecord& lhs, const WalRecord& rhs) {
+    return lhs.lsn == rhs.lsn && lhs.operation == rhs.operation && lhs.document.id == rhs.document.id
+        && (lhs.operation == WalOperation::REMOVE
+            || (lhs.document.text == rhs.document.text && lhs.document.status == rhs.document.status && lhs.document.ratings == rhs.document.ratings
+                && lhs.replaced_ids == rhs.replaced_ids));
+}
+
+std::vector<WalRecord> WriteSampleLog(const std::string& path) {
+    const std::vector<DocumentData> documents = {
+        MakeDocument(1, "white cat", DocumentStatus::ACTUAL, {8, -3}),
+        MakeDocument(1000000, "", DocumentStatus::BANNED, {}),
+        MakeDocument(7, std::string(300, 'x') + " dog", DocumentStatus::IRRELEVANT, {-2000000000, 2000000000}),
+    };
+    std::vector<WalRecord> expected;
+    WalOptions options;
+    options.max_commit_delay = std::chrono::milliseconds{0};
+    WriteAheadLog wal(path, options);
+    wal.Recover(0);
+    for (const DocumentData& document : documents) {
+        WalRecord record;
+        record.document = document;
+        if (document.id == 7) {
+            record.replaced_ids = {3, 1000000};
+        }
+        record.lsn = wal.Append(WalOperation::ADD, document, record.replaced_ids);
+        expected.push_back(record);
+    }
+    WalRecord removal;
+    removal.operation = WalOperation::REMOVE;
+    removal.document.id = 1;
+    removal.lsn = wal.Append(WalOperation::REMOVE, removal.document);
+    expected.push_back(removal);
+    wal.Commit();
+    return expected;
+}
+
+std::vector<WalRecord> RecoverLog(const std::string& path, uint64_t after_lsn = 0) {
+    WriteAheadLog wal(path, WalOptions{});
+    return wal.Recover(after_lsn);
+}
+
+}  // namespace
+
+void TestWriteAheadLog() {
+    Check(Crc32("123456789") == 0xCBF43926u, "CRC-32 check value");
+
+    const std::string directory = MakeTestDirectory("wal_test");
+    const std::string path = directory + "/index.wal";
+
+    const std::vector<WalRecord> expected = WriteSampleLog(path);
+    std::vector<WalRecord> recovered = RecoverLog(path);
+    Check(recovered.size() == expected.size(), "every record is recovered");
+    for (size_t i = 0; i < expected.size(); ++i) {
+        Check(SameRecord(recovered[i], expected[i]), "record " + std::to_string(i) + " round-trips");
+    }
+    Check(RecoverLog(path, 2).size() == 2, "records up to after_lsn are skipped");
+
+    // A torn tail drops the last record and is cut off, so appends continue cleanly.
+    const auto full_size = std::filesystem::file_size(path);
+    std::filesystem::resize_file(path, full_size - 3);
+    {
+        WriteAheadLog wal(path, WalOptions{});
+        Check(wal.Recover(0).size() == expected.size() - 1, "torn tail is dropped");
+        Check(wal.GetLastLsn() == expected.size() - 1, "lsn continues after the last intact record");
+        wal.Append(WalOperation::REMOVE, expected.front().document);
+        wal.Commit();
+    }
+    recovered = RecoverLog(path);
+    Check(recovered.size() == expected.size() && recovered.back().lsn == expected.size(), "append after torn tail");
+
+    // A corrupted payload fails its CRC; recovery stops there and truncates the rest.
+    WriteSampleLog(directory + "/corrupt.wal");
+    {
+        std::fstream file(directory + "/corrupt.wal", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(20);
+        file.put('\x7f');
+    }
+    Check(RecoverLog(directory + "/corrupt.wal").empty(), "records from a CRC mismatch on are dropped");
+    Check(std::filesystem::file_size(directory + "/corrupt.wal") == 0, "corrupted tail is truncated");
+
+    // The flusher commits a pending group once its oldest record waited max_commit_delay.
+    {
+        WalOptions options;
+        options.group_commit_size = 1000;
+        options.max_commit_delay = std::chrono::milliseconds{5};
+        WriteAheadLog wal(directory + "/delay.wal", options);
+        wal.Recover(0);
+        const uint64_t lsn = wal.Append(WalOperation::REMOVE, expected.front().document);
+        Check(wal.GetDurableLsn() < lsn, "a record is acknowledged before its group commits");
+        for (int attempt = 0; attempt < 200 && wal.GetDurableLsn() < lsn; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{5});
+        }
+        Check(wal.GetDurableLsn() == lsn, "the flusher commits within max_commit_delay");
+        const uint64_t next = wal.Append(WalOperation::REMOVE, expected.front().document);
+        wal.WaitDurable(next);
+        Check(wal.GetDurableLsn() == next, "WaitDurable commits the pending group");
+    }
+    std::filesystem::remove_all(directory);
+}
+
+void TestDurableIndex() {
+    const std::string directory = MakeTestDirectory("durable_index_test");
+    WalOptions options;
+    options.group_commit_size = 4;
+    options.checkpoint_interval = 5;
+    const std::string query = "fluffy cat -collar";
+
+    std::vector<Document> expected;
+    {
+        SearchServer search_server("and in"s);
+        DurableIndex index(search_server, directory, options);
+        index.AddDocument(1, "fluffy cat and fluffy tail", DocumentStatus::ACTUAL, {7, 2});
+        index.AddDocument(2, "groomed dog with collar", DocumentStatus::ACTUAL, {1});
+        index.AddDocument(3, "cat in collar", DocumentStatus::ACTUAL, {3});
+        index.AddDocument(4, "fluffy parrot", DocumentStatus::BANNED, {9});
+        // The fifth record triggers a checkpoint; the rest stays in the log tail.
+        index.RemoveDocument(2);
+        index.AddDocument(5, "cat cat cat", DocumentStatus::ACTUAL, {-4});
+        index.RemoveDocument(4);
+        Check(index.RemoveDocument(100) == 0, "removing an unknown document logs nothing");
+        try {
+            index.AddDocument(3, "duplicate id", DocumentStatus::ACTUAL, {1});
+            Check(false, "invalid documents are rejected");
+        } catch (const std::invalid_argument&) {
+        }
+        index.Sync();
+        expected = search_server.FindTopDocuments(query);
+    }
+    {
+        SearchServer search_server("and in"s);
+        DurableIndex index(search_server, directory, options);
+        Check(index.GetRecoveredRecordCount() == 2, "only the tail after the checkpoint is replayed");
+        Check(search_server.GetDocumentCount() == 3, "checkpoint plus tail restore the index");
+        const std::vector<Document> found = search_server.FindTopDocuments(query);
+        Check(found.size() == expected.size(), "recovered index answers like the original");
+        for (size_t i = 0; i < found.size(); ++i) {
+            Check(found[i].id == expected[i].id && found[i].relevance == expected[i].relevance && found[i].rating == expected[i].rating,
+                  "recovered relevance is bit-identical");
+        }
+    }
+    std::filesystem::remove_all(directory);
+}
+
+void TestDurableIndexWriteFailure() {
+    const std::string directory = MakeTestDirectory("durable_failure_test");
+    const std::string wal_path = directory + "/index.wal";
+    const auto live_ids = [](SearchServer& search_server) {
+        return std::vector<int>(search_server.begin(), search_server.end());
+    };
+    WalOptions options;
+    options.group_commit_size = 3;
+    options.max_commit_delay = std::chrono::milliseconds{60000};
+    options.checkpoint_interval = 0;
+    {
+        SearchServer search_server("and"s);
+        DurableIndex index(search_server, directory, options);
+        index.AddDocument(1, "fluffy cat and tail", DocumentStatus::ACTUAL, {7});
+        index.AddDocument(2, "groomed dog", DocumentStatus::ACTUAL, {1});
+        index.Sync();
+        const std::vector<Document> before = search_server.FindTopDocuments("fluffy cat");
+        {
+            const FileSizeLimit limit(std::filesystem::file_size(wal_path));
+            index.AddDocument(3, "fluffy parrot", DocumentStatus::ACTUAL, {3});
+            index.RemoveDocument(1);
+            try {
+                // The third pending record commits the group, and the write fails.
+                index.AddDocument(4, "cat cat", DocumentStatus::ACTUAL, {2});
+                Check(false, "a failed write is reported");
+            } catch (const std::runtime_error&) {
+            }
+        }
+        Check(live_ids(search_server) == std::vector<int>{1, 2}, "the whole dropped group is rolled back");
+        const std::vector<Document> after = search_server.FindTopDocuments("fluffy cat");
+        Check(after.size() == before.size() && after[0].id == before[0].id && after[0].relevance == before[0].relevance,
+              "rolled back removals come back unchanged");
+        try {
+            index.AddDocument(5, "late document", DocumentStatus::ACTUAL, {1});
+            Check(false, "a failed log stays failed");
+        } catch (const std::runtime_error&) {
+        }
+        Check(live_ids(search_server) == std::vector<int>{1, 2}, "mutations on a failed log are rolled back");
+    }
+    {
+        SearchServer search_server("and"s);
+        DurableIndex index(search_server, directory, options);
+        Check(live_ids(search_server) == std::vector<int>{1, 2}, "the log holds what the index kept");
+    }
+
+    // A failure of the background flusher is rolled back by the next call.
+    options.max_commit_delay = std::chrono::milliseconds{1};
+    options.group_commit_size = 32;
+    {
+        SearchServer search_server("and"s);
+        DurableIndex index(search_server, directory, options);
+        {
+            const FileSizeLimit limit(std::filesystem::file_size(wal_path));
+            index.AddDocument(6, "fluffy hamster", DocumentStatus::ACTUAL, {4});
+            index.RemoveDocument(2);
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        }
+        try {
+            index.Sync();
+            Check(false, "a flusher failure is reported");
+        } catch (const std::runtime_error&) {
+        }
+        Check(live_ids(search_server) == std::vector<int>{1, 2}, "the flusher's dropped group is rolled back");
+    }
+    std::filesystem::remove_all(directory);
+}
+
+void TestDurableIndexReplace() {
+    const std::string directory = MakeTestDirectory("durable_replace_test");
+    WalOptions options;
+    options.checkpoint_interval = 0;
+    DuplicateOptions replace;
+    replace.policy = DuplicatePolicy::REPLACE;
+    const std::string text = "fluffy white cat with long tail";
+    const auto live_ids = [](SearchServer& search_server) {
+        return std::vector<int>(search_server.begin(), search_server.end());
+    };
+    {
+        SearchServer search_server("with"s);
+        search_server.SetDuplicateOptions(replace);
+        DurableIndex index(search_server, directory, options);
+        index.AddDocument(1, text, DocumentStatus::ACTUAL, {1});
+        index.AddDocument(2, text, DocumentStatus::ACTUAL, {2});
+        index.AddDocument(3, "groomed dog", DocumentStatus::ACTUAL, {3});
+        Check(live_ids(search_server) == std::vector<int>{2, 3}, "REPLACE removes the older copy");
+    }
+    // Recovery replays what happened, whatever the options of the recovering server.
+    {
+        SearchServer search_server("with"s);
+        DurableIndex index(search_server, directory, options);
+        Check(live_ids(search_server) == std::vector<int>{2, 3}, "replaced documents stay removed under KEEP");
+    }
+    {
+        SearchServer search_server("with"s);
+        DuplicateOptions reject;
+        reject.policy = DuplicatePolicy::REJECT;
+        search_server.SetDuplicateOptions(reject);
+        search_server.SetMemoryBudget(1);
+        DurableIndex index(search_server, directory, options);
+        Check(live_ids(search_server) == std::vector<int>{2, 3}, "recovery ignores REJECT and the memory budget");
+        Check(search_server.GetDuplicateOptions().policy == DuplicatePolicy::REJECT && search_server.GetMemoryBudget() == 1,
+              "recovery restores the options");
+    }
+    std::filesystem::remove_all(directory);
+}
+
+void TestSearchServerMove() {
+    const auto fill = [](SearchServer& search_server) {
+        search_server.AddDocument(1, "fluffy cat fluffy tail", DocumentStatus::ACTUAL, {7, 2});
+        search_server.AddDocument(2, "groomed dog with collar", DocumentStatus::ACTUAL, {1});
+        search_server.AddDocument(3, "cat with collar", DocumentStatus::BANNED, {3});
+    };
+    const std::string query = "fluffy groomed cat";
+    SearchServer reference("with"s);
+    fill(reference);
+    const std::vector<Document> expected = reference.FindTopDocuments(query);
+    const auto same_results = [&](const SearchServer& search_server) {
+        const std::vector<Document> found = search_server.FindTopDocuments(query);
+        if (found.size() != expected.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < found.size(); ++i) {
+            if (found[i].id != expected[i].id || found[i].relevance != expected[i].relevance) {
+                return false;
+            }
+        }
+        return search_server.GetDocumentCount() == 3;
+    };
+
+    // A moved-from server is empty but usable, also after its successor is gone.
+    const auto check_reusable = [&](SearchServer& search_server, const std::string& what) {
+        Check(search_server.GetDocumentCount() == 0 && search_server.FindTopDocuments(query).empty(), what + " leaves the source empty");
+        DuplicateOptions replace;
+        replace.policy = DuplicatePolicy::REPLACE;
+        search_server.SetDuplicateOptions(replace);
+        fill(search_server);
+        search_server.AddDocument(4, "fluffy cat fluffy tail", DocumentStatus::ACTUAL, {1});
+        Check(search_server.GetDocumentCount() == 3 && search_server.FindNearDuplicates(4).empty(), what + " leaves a working near-duplicate index");
+        Check(search_server.GetMemoryUsage().Total() > 0, what + " leaves the source with its own accounting");
+    };
+
+    std::pmr::unsynchronized_pool_resource pool;
+    SearchServer source("with"s, &pool);
+    {
+        fill(source);
+        const size_t source_bytes = source.GetMemoryUsage().Total();
+        SearchServer moved(std::move(source));
+        Check(same_results(moved), "move construction keeps the index");
+        Check(moved.GetMemoryUsage().Total() == source_bytes, "move construction hands over the accounting");
+    }
+    check_reusable(source, "move construction");
+
+    SearchServer reassigned("with"s, &pool);
+    fill(reassigned);
+    {
+        SearchServer moved(std::move(reassigned));
+    }
+    reassigned = SearchServer("with"s);
+    fill(reassigned);
+    Check(same_results(reassigned), "a moved-from server can be assigned a new index");
+
+    std::pmr::monotonic_buffer_resource arena;
+    SearchServer assigned_from("with"s, &arena);
+    {
+        SearchServer target("unused stop words"s, &pool);
+        target.AddDocument(10, "parrot", DocumentStatus::ACTUAL, {1});
+        fill(assigned_from);
+        const size_t source_bytes = assigned_from.GetMemoryUsage().Total();
+        target = std::move(assigned_from);
+        Check(same_results(target), "move assignment keeps the index");
+        Check(target.GetMemoryUsage().Total() == source_bytes, "move assignment hands over the accounting");
+        target.AddDocument(5, "fluffy parrot", DocumentStatus::ACTUAL, {5});
+        Check(target.FindTopDocuments("parrot").size() == 1, "the target stays usable after assignment");
+    }
+    check_reusable(assigned_from, "move assignment");
+}
+
+void TestCompiledQueryServerIdentity() {
+    // The second server reuses the storage of the first and reaches the same index
+    // version, but has far fewer terms: the query's term ids must not be used on it.
+    std::optional<SearchServer> search_server;
+    search_server.emplace("and"s);
+    search_server->AddDocument(1, "alpha beta gamma delta epsilon zeta eta theta cat", DocumentStatus::ACTUAL, {1});
+    search_server->AddDocument(2, "dog", DocumentStatus::ACTUAL, {1});
+    const SearchServer::CompiledQuery query = search_server->CompileQuery("cat theta -dog");
+    const SearchServer* first_address = &*search_server;
+
+    search_server.emplace("and"s);
+    search_server->AddDocument(1, "cat", DocumentStatus::ACTUAL, {1});
+    search_server->AddDocument(2, "cat dog", DocumentStatus::ACTUAL, {1});
+    Check(&*search_server == first_address, "the second server reuses the address");
+    const std::vector<Document> found = search_server->FindTopDocuments(query);
+    Check(found.size() == 1 && found.front().id == 1, "a query compiled on another server is re-resolved");
+    const auto [words, status] = search_server->MatchDocument(query, 1);
+    Check(words == std::vector<std::string_view>{"cat"}, "matching re-resolves the query too");
+    Check(search_server->FindTopDocumentsBatch(std::vector<SearchServer::CompiledQuery>{query}).front().size() == 1,
+          "batch evaluation re-resolves the query too");
+
+    // After a move the source is a different index: queries compiled on either
+    // side must not pass as current (or as owning their term ids) on the other.
+    for (const bool assign : {false, true}) {
+        SearchServer source("and"s);
+        source.AddDocument(1, "alpha beta gamma delta epsilon zeta eta theta cat", DocumentStatus::ACTUAL, {1});
+        const SearchServer::CompiledQuery before_move = source.CompileQuery("cat theta");
+        SearchServer target("and"s);
+        if (assign) {
+            target = std::move(source);
+        } else {
+            SearchServer moved(std::move(source));
+            target = std::move(moved);
+        }
+        Check(target.FindTopDocuments(before_move).size() == 1, "the query follows the index it was compiled on");
+        Check(source.FindTopDocuments(before_move).empty(), "the emptied source does not reuse the query's terms");
+        source.AddDocument(1, "cat", DocumentStatus::ACTUAL, {1});
+        const SearchServer::CompiledQuery after_move = source.CompileQuery("cat");
+        Check(target.FindTopDocuments(after_move).size() == 1, "a query from the reused source is re-resolved on the target");
+    }
+}
+
+void TestCompiledQueryRefresh() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "fluffy cat", DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "groomed dog", DocumentStatus::ACTUAL, {2});
+    // "parrot" and "ha*" are not in the index yet; the stale query must pick them up.
+    const std::string raw_query = "parrot fluffy ha* -groomed";
+    const SearchServer::CompiledQuery query = search_server.CompileQuery(raw_query);
+    const auto same_as_raw = [&]() {
+        const std::vector<Document> expected = search_server.FindTopDocuments(raw_query);
+        const std::vector<Document> found = search_server.FindTopDocuments(query);
+        if (found.size() != expected.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < found.size(); ++i) {
+            if (found[i].id != expected[i].id || found[i].relevance != expected[i].relevance) {
+                return false;
+            }
+        }
+        return true;
+    };
+    Check(same_as_raw(), "a current query matches the raw query");
+    search_server.AddDocument(3, "parrot with hat", DocumentStatus::ACTUAL, {3});
+    search_server.AddDocument(4, "groomed hamster", DocumentStatus::ACTUAL, {4});
+    search_server.AddDocument(5, "fluffy parrot", DocumentStatus::ACTUAL, {5});
+    Check(same_as_raw(), "new words, prefix expansions and IDF weights are refreshed");
+    search_server.RemoveDocument(5);
+    Check(same_as_raw(), "refreshed after a removal");
+    FuzzyOptions fuzzy;
+    fuzzy.max_distance = 1;
+    search_server.SetFuzzyOptions(fuzzy);
+    search_server.AddDocument(6, "parot fluffi", DocumentStatus::ACTUAL, {6});
+    Check(same_as_raw(), "fuzzy options set after compiling apply");
+}
+
+void TestFindTopDocumentsAsync() {
+    // Even ids carry the minus-word; enough documents for several posting blocks.
+    SearchServer search_server(""s);
+    for (int id = 0; id < 4000; ++id) {
+        const std::string text = "cat dog w"s + std::to_string(id % 50) + (id % 2 == 0 ? " collar"s : ""s);
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 7});
+    }
+    const std::string query = "cat w7 -collar";
+    const auto far = std::chrono::steady_clock::now() + std::chrono::hours{1};
+    const auto no_minus_documents = [](const std::vector<Document>& documents) {
+        return std::all_of(documents.begin(), documents.end(), [](const Document& document) { return document.id % 2 == 1; });
+    };
+
+    const SearchResult full = search_server.FindTopDocumentsAsync(query, far).get();
+    const std::vector<Document> expected = search_server.FindTopDocuments(query);
+    Check(full.complete && full.documents.size() == expected.size(), "an unhurried query completes");
+    for (size_t i = 0; i < expected.size(); ++i) {
+        Check(full.documents[i].id == expected[i].id && full.documents[i].relevance == expected[i].relevance,
+              "a complete asynchronous result matches FindTopDocuments");
+    }
+
+    const SearchResult late = search_server.FindTopDocumentsAsync(query, std::chrono::steady_clock::now() - std::chrono::seconds{1}).get();
+    Check(!late.complete, "a past deadline leaves the result incomplete");
+    CancellationToken token;
+    token.Cancel();
+    const SearchResult cancelled = search_server.FindTopDocumentsAsync(query, far, token).get();
+    Check(!cancelled.complete, "a cancelled token leaves the result incomplete");
+
+    // Wherever the deadline cuts the postings, minus-words apply in full.
+    for (int micros = 0; micros <= 2000; micros += 50) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds{micros};
+        const SearchResult result = search_server.FindTopDocumentsAsync(query, deadline).get();
+        Check(no_minus_documents(result.documents), "a partial result never holds minus-word documents");
+    }
+
+    try {
+        search_server.FindTopDocumentsAsync("cat --collar", far).get();
+        Check(false, "a malformed query is reported");
+    } catch (const std::invalid_argument&) {
+    }
+
+    search_server.SetMaxPendingQueries(0);
+    try {
+        search_server.FindTopDocumentsAsync(query, far).get();
+        Check(false, "a query over the limit is rejected");
+    } catch (const std::runtime_error&) {
+    }
+    search_server.SetMaxPendingQueries(64);
+    Check(search_server.FindTopDocumentsAsync(query, far).get().complete, "the pending count is released");
+}
+
+void TestNearDuplicates() {
+    const std::string cat = "fluffy white cat with long tail and green eyes sleeps on warm sofa near big window";
+    const std::string cat_copy = cat + " today";
+    const std::string dog = "groomed black dog with red collar runs across wet grass after small ball";
+    const auto live_ids = [](SearchServer& search_server) {
+        return std::vector<int>(search_server.begin(), search_server.end());
+    };
+    const auto fill = [&](SearchServer& search_server) {
+        search_server.AddDocument(1, cat, DocumentStatus::ACTUAL, {1});
+        search_server.AddDocument(2, dog, DocumentStatus::ACTUAL, {2});
+        search_server.AddDocument(3, cat_copy, DocumentStatus::ACTUAL, {3});
+        search_server.AddDocument(4, dog, DocumentStatus::ACTUAL, {4});
+        search_server.AddDocument(5, "unrelated parrot", DocumentStatus::ACTUAL, {5});
+        search_server.AddDocument(6, cat, DocumentStatus::BANNED, {6});
+    };
+    {
+        SearchServer search_server("with and on"s);
+        fill(search_server);
+        Check(search_server.FindNearDuplicates(1) == std::vector<int>{3, 6}, "near-duplicates of a document are found and sorted");
+        Check(search_server.FindNearDuplicates(5).empty(), "distinct documents are not near-duplicates");
+        Check(search_server.FindNearDuplicates(dog) == std::vector<int>{2, 4}, "near-duplicates of a text are found");
+        try {
+            search_server.FindNearDuplicates(100);
+            Check(false, "unknown ids are reported");
+        } catch (const std::out_of_range&) {
+        }
+        const std::vector<std::vector<int>> groups = {{1, 3, 6}, {2, 4}};
+        Check(search_server.FindNearDuplicateGroups(std::execution::seq) == groups, "groups are connected components ordered by first id");
+        Check(search_server.FindNearDuplicateGroups(std::execution::par) == groups, "parallel grouping matches sequential");
+        Check(search_server.RemoveNearDuplicates(std::execution::seq) == std::vector<int>{3, 4, 6}, "the first document of each group is kept");
+        Check(live_ids(search_server) == std::vector<int>{1, 2, 5}, "removed near-duplicates leave the index");
+        Check(search_server.FindNearDuplicateGroups(std::execution::seq).empty(), "no groups remain after removal");
+    }
+    {
+        SearchServer search_server("with and on"s);
+        fill(search_server);
+        Check(search_server.RemoveNearDuplicates(std::execution::par) == std::vector<int>{3, 4, 6}, "parallel removal matches sequential");
+        Check(live_ids(search_server) == std::vector<int>{1, 2, 5}, "parallel removal leaves the same index");
+    }
+    {
+        SearchServer search_server("with and on"s);
+        DuplicateOptions reject;
+        reject.policy = DuplicatePolicy::REJECT;
+        search_server.SetDuplicateOptions(reject);
+        search_server.AddDocument(1, cat, DocumentStatus::ACTUAL, {1});
+        try {
+            search_server.AddDocument(2, cat_copy, DocumentStatus::ACTUAL, {2});
+            Check(false, "REJECT refuses a near-duplicate");
+        } catch (const std::invalid_argument&) {
+        }
+        search_server.AddDocument(3, dog, DocumentStatus::ACTUAL, {3});
+        Check(live_ids(search_server) == std::vector<int>{1, 3}, "REJECT keeps the index unchanged and accepts new documents");
+    }
+    {
+        SearchServer search_server("with and on"s);
+        DuplicateOptions replace;
+        replace.policy = DuplicatePolicy::REPLACE;
+        search_server.SetDuplicateOptions(replace);
+        search_server.AddDocument(1, cat, DocumentStatus::ACTUAL, {1});
+        search_server.AddDocument(2, dog, DocumentStatus::ACTUAL, {2});
+        search_server.AddDocument(3, cat_copy, DocumentStatus::ACTUAL, {3});
+        Check(live_ids(search_server) == std::vector<int>{2, 3}, "REPLACE swaps the older copy for the new document");
+        Check(search_server.FindTopDocuments("fluffy cat").front().id == 3, "the replacement is searchable");
+    }
+}
+
+void TestFindWithinDistance() {
+    // A small alphabet makes many terms close to each other.
+    std::mt19937 generator(29);
+    TermDictionary dictionary;
+    for (int i = 0; i < 600; ++i) {
+        dictionary.Add(RandomWord(generator, "abcd", 6));
+    }
+    dictionary.Compact();
+    // These stay in the overlay.
+    for (int i = 0; i < 300; ++i) {
+        dictionary.Add(RandomWord(generator, "abcde", 6));
+    }
+    for (int i = 0; i < 100; ++i) {
+        const std::string query = RandomWord(generator, "abcde", 7);
+        for (int max_distance = 0; max_distance <= 2; ++max_distance) {
+            std::vector<std::pair<TermId, int>> expected;
+            for (TermId id = 0; id < dictionary.Size(); ++id) {
+                const int distance = LevenshteinDistance(query, dictionary.GetTerm(id));
+                if (distance <= max_distance) {
+                    expected.emplace_back(id, distance);
+                }
+            }
+            std::vector<std::pair<TermId, int>> found = dictionary.FindWithinDistance(query, max_distance);
+            std::sort(found.begin(), found.end());
+            Check(found == expected, "FindWithinDistance matches brute-force Levenshtein over array and overlay");
+        }
+    }
+}
+
+void TestFuzzySearch() {
+    SearchServer search_server(""s);
+    const std::vector<std::string> words = {"kitten", "kittan", "kattin", "kitteb", "kittec", "puppy", "puppa", "puppb", "puppc"};
+    for (size_t id = 0; id < words.size(); ++id) {
+        search_server.AddDocument(static_cast<int>(id), words[id], DocumentStatus::ACTUAL, {1});
+    }
+    const auto relevance_of = [](const std::vector<Document>& documents, int id) {
+        const auto it = std::find_if(documents.begin(), documents.end(), [id](const Document& document) { return document.id == id; });
+        return it == documents.end() ? 0.0 : it->relevance;
+    };
+
+    // Every term has the same idf here, so relevance ratios are the penalties.
+    FuzzyOptions fuzzy;
+    fuzzy.max_distance = 2;
+    for (const double penalty : {0.5, 0.3}) {
+        fuzzy.distance_penalty = penalty;
+        search_server.SetFuzzyOptions(fuzzy);
+        const std::vector<Document> found = search_server.FindTopDocuments("kitten");
+        const double exact = relevance_of(found, 0);
+        Check(exact > 0 && std::abs(relevance_of(found, 1) - exact * penalty) < 1e-9, "one edit scales the score by distance_penalty");
+        Check(std::abs(relevance_of(found, 2) - exact * penalty * penalty) < 1e-9, "two edits scale the score by distance_penalty squared");
+    }
+
+    fuzzy.max_distance = 1;
+    fuzzy.max_expansions_per_word = 2;
+    search_server.SetFuzzyOptions(fuzzy);
+    Check(search_server.FindTopDocuments("kitten").size() == 3, "a word expands to at most max_expansions_per_word terms");
+    fuzzy.max_expansions_per_word = 3;
+    fuzzy.max_expansions_per_query = 2;
+    search_server.SetFuzzyOptions(fuzzy);
+    const std::vector<Document> found = search_server.FindTopDocuments("kitten puppy");
+    Check(found.size() == 4 && relevance_of(found, 0) > 0 && relevance_of(found, 5) > 0,
+          "a query expands to at most max_expansions_per_query terms besides its exact words");
+}
+
+void TestTermDictionary() {
+    std::mt19937 generator(28);
+    TermDictionary dictionary;
+    std::map<std::string, TermId> expected;
+    std::vector<std::string_view> first_views;
+    // Enough terms for Add to merge the overlay into the sorted array more than once.
+    for (int i = 0; i < 3000; ++i) {
+        const std::string word = RandomWord(generator, "abcdefgh", 8);
+        const TermId id = dictionary.Add(word);
+        Check(expected.emplace(word, id).first->second == id, "a term keeps its id");
+        if (first_views.size() < 100) {
+            first_views.push_back(dictionary.GetTerm(id));
+        }
+    }
+    const auto check_lookups = [&](const std::string& when) {
+        Check(dictionary.Size() == expected.size(), "every distinct term is interned once " + when);
+        for (const auto& [word, id] : expected) {
+            Check(dictionary.Find(word) == id && dictionary.GetTerm(id) == word, "terms and ids map both ways " + when);
+        }
+        Check(!dictionary.Find("abcdefghz"), "unknown terms are not found " + when);
+        for (const std::string prefix : {"", "a", "bc", "hhh"}) {
+            std::vector<std::string> visited;
+            dictionary.ForEachWithPrefix(prefix, [&](TermId id, std::string_view term) {
+                Check(dictionary.GetTerm(id) == term, "prefix visits pass matching ids and terms " + when);
+                visited.emplace_back(term);
+                return true;
+            });
+            std::vector<std::string> with_prefix;
+            for (auto it = expected.lower_bound(prefix); it != expected.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+                with_prefix.push_back(it->first);
+            }
+            Check(visited == with_prefix, "prefix visits are complete and ordered " + when);
+        }
+        size_t visits = 0;
+        dictionary.ForEachWithPrefix("a", [&visits](TermId, std::string_view) { return ++visits < 3; });
+        Check(visits == 3, "a prefix visit stops when the visitor returns false " + when);
+    };
+    check_lookups("with a live overlay");
+    dictionary.Compact();
+    check_lookups("after a merge");
+    for (std::string_view view : first_views) {
+        Check(dictionary.Find(view) && dictionary.GetTerm(*dictionary.Find(view)).data() == view.data(), "merges do not move term text");
+    }
+}
+
+void TestPrefixQueries() {
+    const auto ids = [](const std::vector<Document>& documents) {
+        std::vector<int> result;
+        for (const Document& document : documents) {
+            result.push_back(document.id);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    {
+        SearchServer search_server(""s);
+        search_server.AddDocument(1, "abc abcd", DocumentStatus::ACTUAL, {1});
+        search_server.AddDocument(2, "abcx dog", DocumentStatus::ACTUAL, {2});
+        search_server.AddDocument(3, "ab cat", DocumentStatus::ACTUAL, {3});
+        search_server.AddDocument(4, "abcd collar", DocumentStatus::ACTUAL, {4});
+        Check(ids(search_server.FindTopDocuments("abc*")) == std::vector<int>{1, 2, 4}, "a prefix word matches every term it starts");
+        Check(ids(search_server.FindTopDocuments("cat dog collar -abc*")) == std::vector<int>{3}, "a prefix minus-word excludes every term it starts");
+        Check(std::get<0>(search_server.MatchDocument("abc*", 1)) == std::vector<std::string_view>{"abc", "abcd"}, "MatchDocument reports the expanded terms");
+        Check(std::get<0>(search_server.MatchDocument("cat -abc*", 2)).empty(), "MatchDocument applies prefix minus-words");
+
+        // Matched words are dictionary views, not views of the query text.
+        std::string raw_query = "abc* dog";
+        const auto [words, status] = search_server.MatchDocument(raw_query, 2);
+        raw_query.assign(raw_query.size(), 'z');
+        raw_query.clear();
+        raw_query.shrink_to_fit();
+        Check(words == std::vector<std::string_view>{"abcx", "dog"} && status == DocumentStatus::ACTUAL, "matched words outlive the query text");
+    }
+    {
+        SearchServer search_server(""s);
+        std::vector<std::string> words;
+        for (int id = 0; id < 100; ++id) {
+            words.push_back("pre"s + std::to_string(id));
+            search_server.AddDocument(id, words.back(), DocumentStatus::ACTUAL, {1});
+        }
+        std::vector<std::string> sorted_words = words;
+        std::sort(sorted_words.begin(), sorted_words.end());
+        const auto expanded = [&](int id) {
+            return !std::get<0>(search_server.MatchDocument("pre*", id)).empty();
+        };
+        const auto expanded_count = [&] {
+            int count = 0;
+            for (int id : search_server) {
+                count += expanded(id) ? 1 : 0;
+            }
+            return count;
+        };
+        Check(expanded_count() == MAX_PREFIX_EXPANSION, "a prefix expands to at most MAX_PREFIX_EXPANSION terms");
+        const int first = std::stoi(sorted_words[0].substr(3));
+        const int next = std::stoi(sorted_words[MAX_PREFIX_EXPANSION].substr(3));
+        Check(expanded(first) && !expanded(next), "the first terms in lexicographic order are kept");
+        search_server.RemoveDocument(first);
+        Check(expanded_count() == MAX_PREFIX_EXPANSION && expanded(next), "terms without documents do not use up the cap");
+    }
+}
+
+void TestSearchServer() {
+    TestWriteAheadLog();
+    TestDurableIndex();
+    TestDurableIndexWriteFailure();
+    TestDurableIndexReplace();
+    TestSearchServerMove();
+    TestCompiledQueryServerIdentity();
+    TestCompiledQueryRefresh();
+    TestFindTopDocumentsAsync();
+    TestNearDuplicates();
+    TestFindWithinDistance();
+    TestFuzzySearch();
+    TestTermDictionary();
+    TestPrefixQueries();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Self-checks of the index subsystems; each throws std::logic_error on the first failed check.
+void TestWriteAheadLog();
+void TestDurableIndex();
+void TestDurableIndexWriteFailure();
+void TestDurableIndexReplace();
+void TestSearchServerMove();
+void TestCompiledQueryServerIdentity();
+void TestCompiledQueryRefresh();
+void TestFindTopDocumentsAsync();
+void TestNearDuplicates();
+void TestFindWithinDistance();
+void TestFuzzySearch();
+void TestTermDictionary();
+void TestPrefixQueries();
+
+void TestSearchServer();